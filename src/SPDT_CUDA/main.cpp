@@ -21,6 +21,7 @@ vector<int> featureNum = {123, 22, 1000000, 47236, 54, 300,
                           200, 1000};
 string help_msg = "-l: max_num_leaf.\n-d: max_depth.\n-n: number of"\
                   "threads.\n-b: max_bin_size\n-l: max_num_leaf\n-e: min_node_size\n";
+int NUM_OF_THREAD = 8;
 
 int main(int argc, char **argv) {
 
@@ -32,12 +33,15 @@ int main(int argc, char **argv) {
     int max_depth = -1;
     char c;
 
-    while((c = getopt(argc, argv, "i:")) != -1 ){
+    while((c = getopt(argc, argv, "i:n:")) != -1 ){
         switch (c)
         {
         case 'i':
             index = (int)std::atoi(optarg);            
             break;        
+        case 'n':
+            NUM_OF_THREAD = (int)std::atoi(optarg);
+            break;
         default:
             break;
         }
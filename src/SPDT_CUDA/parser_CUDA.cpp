@@ -4,12 +4,14 @@
 
 Dataset::Dataset() {
 	num_pos_label=0;
+	cursor=NULL;
 }
 
 Dataset::Dataset(int _num_of_data):		
 	num_of_data(_num_of_data) {
 	already_read_data = 0;
 	num_pos_label = 0;
+	cursor = NULL;
 	label_ptr = (int*)calloc(_num_of_data, sizeof(int));
 	value_ptr = (float*)calloc((long long int)_num_of_data * num_of_features, sizeof(float));
 	histogram_id_ptr = (int*)calloc(_num_of_data, sizeof(int));
@@ -21,57 +23,160 @@ Dataset::~Dataset() {
 	free(histogram_id_ptr);	
 }
 
-void Dataset::read_a_data(int index) {		
-	float tmpvalue;	
+/*
+ * Parse one LIBSVM row in place into the dense row `index`.
+ * Return the position right after the row.
+ */
+const char* Dataset::read_a_data(int index, const char* p, const char* end) {		
+	double tmpvalue;	
 	
 	bool isFirst = true;
 	int feature;
+	const char* eol = next_line(p, end);
 
-	string str, prev, indexstr, valuestr;
-	getline(myfile, str);	
-
-	size_t npos;
-
-	// cout << "str: " << str << endl;	
-
-	while (str.size() > 0) {
-		npos = str.find(' ');
-		if (npos == string::npos) break;
-		prev = str.substr(0, npos);		
-		str = str.substr(npos + 1);
-		if (prev.size() == 0 || prev[0] < '+') continue;				
+	while (p < eol) {
+		while (p < eol && (is_blank(*p) || *p == '\n')) p++;
+		if (p == eol) break;
+		if (*p < '+') {
+			while (p < eol && !is_blank(*p) && *p != '\n') p++;
+			continue;
+		}
 		if (isFirst) {
-			// cout << "prev: " << prev << endl;
-			label_ptr[index] = stoi(prev) == -1 ? 0 : stoi(prev);					
+			int label = 0;
+			p = parse_int(p, eol, label);
+			label_ptr[index] = label == -1 ? 0 : label;					
 			isFirst = false;
 		} else {
-			// cout << "prev: " << prev << endl;
-			npos = prev.find(':');
-			indexstr = prev.substr(0, npos);
-			// cout << "indexstr: " << indexstr << endl;
-			feature = stoi(indexstr);
-			valuestr = prev.substr(npos + 1);
-			// cout << "valuestr: " << valuestr << endl;
-			tmpvalue = stod(valuestr);
-			// cout << "index: " << index << "tmpvalue: " << tmpvalue << endl;
-			value_ptr[index * num_of_features + feature - 1] = tmpvalue;			
+			const char* q = parse_int(p, eol, feature);
+			if (q != p && q < eol && *q == ':' && feature >= 1 && feature <= num_of_features) {
+				p = parse_double(q + 1, eol, tmpvalue);
+				value_ptr[(long long int)index * num_of_features + feature - 1] = tmpvalue;			
+			} else {
+				p = q;
+			}
 		}
+		// skip whatever is left of a malformed token
+		while (p < eol && !is_blank(*p) && *p != '\n') p++;
 	}
+	return eol;
 }
 
 void Dataset::open_read_data(string name) {
-	myfile.open(name, fstream::in);
+	if (cache.open(name, num_of_classes)) {
+		if (cache.num_rows() < num_of_data) num_of_data = cache.num_rows();
+		return;
+	}
+	if (!myfile.open(name)) {
+		fprintf(stderr, "ERROR: can not open %s\n", name.c_str());
+		exit(-1);
+	}
+	cursor = myfile.begin;
+	if (!cache_writer.open(name, num_of_classes)) {
+		fprintf(stderr, "WARNING: can not write the binary cache of %s\n", name.c_str());
+	}
+}
+
+/* scatter the next N rows of the mapped cache into the dense rows, return how many */
+int Dataset::read_cached_batch(int N) {
+	long long left = cache.num_rows() - already_read_data;
+	int found = (left < N) ? (int) left : N;
+	if (found <= 0) return 0;
+	int pos = 0;
+	#pragma omp parallel for schedule(static) num_threads(NUM_OF_THREAD) reduction(+:pos)
+	for (int i = 0; i < found; i++) {
+		long long row = already_read_data + i;
+		float* dense = value_ptr + (long long int)i * num_of_features;
+		memset(dense, 0, sizeof(float) * num_of_features);
+		for (long long k = cache.row_offset[row]; k < cache.row_offset[row + 1]; k++) {
+			if (cache.feature_index[k] < num_of_features)
+				dense[cache.feature_index[k]] = cache.feature_value[k];
+		}
+		label_ptr[i] = cache.labels[row];
+		if (label_ptr[i] == POS_LABEL) pos++;
+	}
+	num_pos_label += pos;
+	return found;
+}
+
+/* parse the next N rows of the text file into the dense rows, return how many */
+int Dataset::read_text_batch(int N) {		
+	const char* end = myfile.end;
+	int found = 0;
+	const char* batch_begin = cursor;
+	const char* batch_end = cursor;
+	if (cursor != NULL && N > 0) {
+		batch_end = skip_rows(cursor, end, N, found);
+	}
+
+	// split the batch at line boundaries and parse the chunks in parallel.
+	// rows are written at their position in the file.
+	int workers = 1;
+	#if defined(_OPENMP)
+		workers = NUM_OF_THREAD;
+	#endif
+	vector<const char*> bounds;
+	split_at_lines(batch_begin, batch_end, workers, bounds);
+	int num_chunks = bounds.size() - 1;
+	vector<int> first_row(num_chunks + 1, 0);
+	#pragma omp parallel for schedule(static) num_threads(workers)
+	for (int k = 0; k < num_chunks; k++) {
+		first_row[k + 1] = count_rows(bounds[k], bounds[k + 1]);
+	}
+	for (int k = 0; k < num_chunks; k++) {
+		first_row[k + 1] += first_row[k];
+	}
+
+	int pos = 0;
+	#pragma omp parallel for schedule(static) num_threads(workers) reduction(+:pos)
+	for (int k = 0; k < num_chunks; k++) {
+		const char* p = bounds[k];
+		const char* chunk_end = bounds[k + 1];
+		for (int i = first_row[k]; i < first_row[k + 1]; i++) {
+			p = next_row(p, chunk_end);
+			p = read_a_data(i, p, chunk_end);
+			if (label_ptr[i] == POS_LABEL) pos++;
+		}
+	}
+	num_pos_label += pos;
+	cursor = batch_end;
+
+	if (cache_writer.is_open()) {
+		// the cache holds the nonzeros of the dense rows, labeled like the general parser does
+		vector<int> labels(found);
+		vector<long long> row_offset(1, 0);
+		vector<int> feature_index;
+		vector<float> feature_value;
+		for (int i = 0; i < found; i++) {
+			labels[i] = label_ptr[i];
+			if (labels[i] != POS_LABEL && num_of_classes == 2) labels[i] = NEG_LABEL;
+			float* dense = value_ptr + (long long int)i * num_of_features;
+			for (int f = 0; f < num_of_features; f++) {
+				if (dense[f] != 0) {
+					feature_index.push_back(f);
+					feature_value.push_back(dense[f]);
+				}
+			}
+			row_offset.push_back(feature_index.size());
+		}
+		cache_writer.append(found, labels.data(), row_offset.data(), 
+			feature_index.data(), feature_value.data(), POS_LABEL);
+		// only a completely parsed file is worth caching
+		if (next_row(cursor, end) == end) {
+			cache_writer.finish();
+		}
+	}
+	return found;
 }
 
 /* return whether there are still data left or not */
 bool Dataset::streaming_read_data(int N) {		
-	for (int i = 0; i < N; i++) {
-		read_a_data(i);		
-		if (label_ptr[i] == POS_LABEL) num_pos_label++;
-		already_read_data++;
-		if (already_read_data == num_of_data) {
-			break;
-		}
+	int want = min(N, num_of_data - already_read_data);
+	int found = cache.is_open() ? read_cached_batch(want) : read_text_batch(want);
+	already_read_data += found;
+
+	// the file holds fewer rows than requested
+	if (found < want) {
+		num_of_data = already_read_data;
 	}
 
 	return (already_read_data < num_of_data);
@@ -79,4 +184,7 @@ bool Dataset::streaming_read_data(int N) {
 
 void Dataset::close_read_data() {
 	myfile.close();
+	cursor = NULL;
+	cache_writer.discard();
+	cache.close();
 }
@@ -4,6 +4,8 @@
 #include <map>
 #include <unordered_map>
 #include <vector>
+#include "../SPDT_general/mmap_reader.h"
+#include "../SPDT_general/binary_cache.h"
 
 using namespace std;
 
@@ -20,7 +22,11 @@ public:
     float *value_ptr;
     int *histogram_id_ptr;
 	
-	ifstream myfile;
+	MappedFile myfile;
+	const char* cursor;
+	// binary cache of the file: read from it when present, written otherwise
+	BinaryCache cache;
+	BinaryCacheWriter cache_writer;
 
 	int already_read_data;
 
@@ -29,7 +35,9 @@ public:
 	~Dataset();
 
 	void open_read_data(string name);
-	void read_a_data(int index);
+	const char* read_a_data(int index, const char* p, const char* end);
 	bool streaming_read_data(int N);
+	int read_text_batch(int N);
+	int read_cached_batch(int N);
 	void close_read_data();
 };
\ No newline at end of file
@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <new>
+#include <algorithm>
+#include <cmath>
+#include "../SPDT_general/array.h"
+#include "../SPDT_general/gain.h"
+#include "../SPDT_general/timing.h"
+
+/*
+ * Microbenchmark of the streaming histogram update (update_array).
+ * Insert a fixed pseudo-random stream into one histogram for every bin count
+ * B = 16, 32, ..., 1024 and report updates per second, with the kernels
+ * specialized for B (where there are, see select_histogram_kernels) and with
+ * the generic ones. CHECKSUM hashes the final bins, which both must agree on,
+ * so two builds of array.cpp can also be checked to give the same result.
+ * ALLOCS counts the heap allocations of the timed loop in the last repeat,
+ * once the buffers have grown; the update and split finding paths should
+ * make none.
+ * usage: ./array-bench [-u updates] [-r repeat] [-d distinct_values] [-s stage] [-m] [-k ways] [-a] [-w features]
+ * -d draws the values from that many distinct ones (0 = continuous).
+ * -s inserts the values in groups of `stage` with update_array_batch.
+ * -m times merge_arrays + uniform_array of two filled histograms in the
+ *    buffers of split_scratch() (the split finding path) instead, `updates`
+ *    times.
+ * -k times merging `ways` filled histograms, e.g. of the threads or ranks,
+ *    with one merge_arrays against ways - 1 merge_array_pointers instead,
+ *    `updates` times; CHECKSUM and PAIRWISE hash the two results. From three
+ *    ways on they differ: the chain shrinks after every merge.
+ * -a compares the accuracy of folding staged values (update_array_batch in
+ *    groups of `stage`, HISTOGRAM_STAGE_SIZE by default, as compress does)
+ *    with inserting them one at a time instead: the same `updates` values go
+ *    into both, and sum_array is checked against the exact count of values
+ *    <= v at the 63 quantiles k/64 of the stream. Errors are in units of
+ *    `updates`.
+ * -w stress-tests the histogram addressing of wide feature spaces instead:
+ *    STRESS_LEAVES leaves of `features` features with 256 bins, over 2^31
+ *    histogram floats if they were dense, for the default 500000 (-w 0).
+ *    Histograms spread over the whole range are filled and checked for their
+ *    own values; an aliased histogram shows up as a wrong count, a foreign
+ *    value or a neighbour that is not empty. Only the features filled get
+ *    storage.
+ */
+
+int num_of_features = 1;
+int num_of_classes = 2;
+int max_bin_size = -1;
+int max_num_leaves = 1;
+int NUM_OF_THREAD = 1;
+
+static unsigned long long seed;
+
+// heap allocations so far, counted by the operator new below
+static long long allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if (p == NULL) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+static float next_value(int distinct) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    unsigned int r = (unsigned int) (seed >> 33);
+    if (distinct > 0) return (float) (r % distinct) / distinct;
+    // a skewed continuous distribution, as features usually are
+    float u = r / 2147483648.0f;
+    return u * u * 100.0f;
+}
+
+static unsigned long long hash_float(unsigned long long h, float x) {
+    unsigned int bits;
+    memcpy(&bits, &x, sizeof(bits));
+    return (h ^ bits) * 1099511628211ULL;
+}
+
+/* hashes the size, then (freq, value) of every bin, all as floats */
+static unsigned long long checksum(BinArray histo) {
+    unsigned long long h = 1469598103934665603ULL;
+    int n = get_bin_size(histo);
+    h = hash_float(h, (float) n);
+    for (int i = 0; i < n; i++) {
+        h = hash_float(h, (float) get_bin_freq(histo, i));
+        h = hash_float(h, get_bin_value(histo, i));
+    }
+    return h;
+}
+
+/* fill the two histograms of class 0 and 1 of feature 0, and their prefix arrays */
+static void fill(int distinct) {
+    seed = 42;
+    for (int i = 0; i < 100000; i++)
+        update_array(0, 0, i & 1, next_value(distinct));
+    build_prefix_arrays(0);
+}
+
+/* updates (or merges) per second of the current histogram_kernels, the checksum and ALLOCS */
+static double run(int updates, int repeat, int distinct, int stage, bool merge, unsigned long long &sum, long long &allocs) {
+    float *staged = new float[stage > 0 ? stage : 1];
+    SplitScratch &scratch = split_scratch();
+    BinArray merged = scratch.merged.bins(max_bin_size + 1);
+    BinArray classes[2];
+    double best = 1e30;
+    for (int r = 0; r < repeat; r++) {
+        acquire_histograms(1);
+        if (merge) fill(distinct);
+        seed = 42;
+        long long before = allocations;
+        Timer t = Timer();
+        if (merge) {
+            classes[0] = get_histogram_array(0, 0, 0);
+            classes[1] = get_histogram_array(0, 0, 1);
+            for (int i = 0; i < updates; i++) {
+                merge_arrays(merged, classes, 2);
+                uniform_array(scratch.splits, 0, 0, 0, merged);
+            }
+        } else if (stage > 0) {
+            for (int i = 0; i < updates; i += stage) {
+                int n = (updates - i < stage) ? updates - i : stage;
+                for (int k = 0; k < n; k++) staged[k] = next_value(distinct);
+                update_array_batch(0, 0, 0, staged, n);
+            }
+        } else {
+            for (int i = 0; i < updates; i++)
+                update_array(0, 0, 0, next_value(distinct));
+        }
+        double elapsed = t.elapsed();
+        allocs = allocations - before;
+        if (elapsed < best) best = elapsed;
+        sum = checksum(merge ? merged : get_histogram_array(0, 0, 0));
+    }
+    delete[] staged;
+    return updates / best;
+}
+
+/* merges per second of `ways` histograms with merge_arrays and pairwise */
+static void run_ways(int ways, int updates, int repeat, int distinct) {
+    num_of_features = ways;
+    BinBuffer merged(max_bin_size + 1);
+    std::vector<BinArray> in(ways);
+    double best = 1e30, best_pairwise = 1e30;
+    unsigned long long sum = 0, pairwise_sum = 0;
+    for (int r = 0; r < repeat; r++) {
+        acquire_histograms(1);
+        seed = 42;
+        for (int f = 0; f < ways; f++) {
+            for (int i = 0; i < 100000; i++)
+                update_array(0, f, 0, next_value(distinct) + f);
+            in[f] = get_histogram_array(0, f, 0);
+        }
+        Timer t = Timer();
+        for (int i = 0; i < updates; i++)
+            merge_arrays(merged.bins(), in.data(), ways);
+        best = std::min(best, t.elapsed());
+        sum = checksum(merged.bins());
+        t.reset();
+        for (int i = 0; i < updates; i++) {
+            copy_array(merged.bins(), in[0]);
+            for (int f = 1; f < ways; f++)
+                merge_array_pointers(merged.bins(), in[f]);
+        }
+        best_pairwise = std::min(best_pairwise, t.elapsed());
+        pairwise_sum = checksum(merged.bins());
+    }
+    printf("MERGE B: %d WAYS: %d MERGES/s: %f PAIRWISE/s: %f SPEEDUP: %.2f CHECKSUM: %016llx PAIRWISE: %016llx\n",
+        max_bin_size, ways, updates / best, updates / best_pairwise, best_pairwise / best, sum, pairwise_sum);
+}
+
+/* |sum_array - exact| / n at the 63 quantiles of `sorted`, mean and max */
+static void cdf_error(int label, const std::vector<float> &sorted, double &mean, double &max) {
+    int n = sorted.size();
+    mean = max = 0;
+    for (int k = 1; k < 64; k++) {
+        float v = sorted[(long long) k * n / 64];
+        long long exact = std::upper_bound(sorted.begin(), sorted.end(), v) - sorted.begin();
+        double err = std::abs(sum_array(0, 0, label, v) - exact) / n;
+        mean += err / 63;
+        max = std::max(max, err);
+    }
+}
+
+/* error of the histogram of class 0, filled one value at a time, and class 1, staged */
+static void run_accuracy(int updates, int distinct, int stage) {
+    if (stage <= 0) stage = HISTOGRAM_STAGE_SIZE;
+    std::vector<float> values(updates);
+    seed = 42;
+    for (int i = 0; i < updates; i++)
+        values[i] = next_value(distinct);
+    acquire_histograms(1);
+    for (int i = 0; i < updates; i++)
+        update_array(0, 0, 0, values[i]);
+    for (int i = 0; i < updates; i += stage)
+        update_array_batch(0, 0, 1, &values[i], std::min(stage, updates - i));
+    build_prefix_arrays(0);
+    std::sort(values.begin(), values.end());
+    double stream_mean, stream_max, fold_mean, fold_max;
+    cdf_error(0, values, stream_mean, stream_max);
+    cdf_error(1, values, fold_mean, fold_max);
+    printf("ACCURACY B: %d STAGE: %d STREAM_MEAN: %f STREAM_MAX: %f FOLD_MEAN: %f FOLD_MAX: %f\n",
+        max_bin_size, stage, stream_mean, stream_max, fold_mean, fold_max);
+}
+
+#define STRESS_LEAVES 4
+#define STRESS_VALUES 300
+
+/* the values of histogram (j, f, c): base + k / 8 for k < STRESS_VALUES */
+static float stress_base(int j, int f, int c) {
+    return (float) (((long long) j * 7919 + (long long) f * 31 + c * 17) % 100000);
+}
+
+static int stress_wide(int features) {
+    num_of_features = features;
+    max_bin_size = 256;
+    alloc_histograms(STRESS_LEAVES);
+    acquire_histograms(STRESS_LEAVES);
+    long long floats = (long long) STRESS_LEAVES * features * num_of_classes * 2 * histogram_lane;
+    int stride = features / 1000 > 1 ? features / 1000 : 1;
+    int checked = 0, errors = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int j = 0; j < STRESS_LEAVES; j++) {
+            for (long long f = j; f < features; f += stride) {
+                for (int c = 0; c < num_of_classes; c++) {
+                    float base = stress_base(j, f, c);
+                    if (pass == 0) {
+                        for (int k = 0; k < STRESS_VALUES; k++)
+                            update_array(j, f, c, base + k / 8.f);
+                        continue;
+                    }
+                    BinArray histo = get_histogram_array(j, f, c);
+                    unsigned long long total = 0;
+                    for (int i = 0; i < get_bin_size(histo); i++) {
+                        total += get_bin_freq(histo, i);
+                        float v = get_bin_value(histo, i);
+                        if (v < base || v > base + STRESS_VALUES / 8.f) errors++;
+                    }
+                    if (total != STRESS_VALUES) errors++;
+                    // the next feature was never filled
+                    if (f + 1 < features && (f + 1 - j) % stride != 0 && find_feature_block(j, f + 1) != NULL) errors++;
+                    checked++;
+                }
+            }
+        }
+    }
+    printf("STRESS features: %d leaves: %d dense_floats: %lld pool: %.1f MB histograms: %d errors: %d %s\n",
+        features, STRESS_LEAVES, floats, histogram_pool_stats.peak_bytes / 1024.f / 1024.f, checked, errors, errors ? "FAIL" : "OK");
+    free_histograms();
+    return errors ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    int updates = 1000000;
+    int repeat = 3;
+    int distinct = 0;
+    int stage = 0;
+    bool merge = false;
+    int wide = -1;
+    int ways = 0;
+    bool accuracy = false;
+    int c;
+    while((c = getopt(argc, argv, "u:r:d:s:mk:aw:")) != -1 ){
+        switch (c)
+        {
+        case 'u':
+            updates = (int)std::atoi(optarg);
+            break;
+        case 'r':
+            repeat = (int)std::atoi(optarg);
+            break;
+        case 'd':
+            distinct = (int)std::atoi(optarg);
+            break;
+        case 's':
+            stage = (int)std::atoi(optarg);
+            break;
+        case 'm':
+            merge = true;
+            break;
+        case 'k':
+            ways = (int)std::atoi(optarg);
+            break;
+        case 'a':
+            accuracy = true;
+            break;
+        case 'w':
+            wide = (int)std::atoi(optarg);
+            break;
+        default:
+            break;
+        }
+    }
+    if (wide >= 0)
+        return stress_wide(wide > 0 ? wide : 500000);
+    if ((merge || ways > 0) && updates == 1000000) updates = 20000;
+
+    for (int B = 16; B <= 1024; B *= 2) {
+        max_bin_size = B;
+        alloc_histograms(1);
+        if (ways > 0) {
+            run_ways(ways, updates, repeat, distinct);
+            free_histograms();
+            continue;
+        }
+        if (accuracy) {
+            run_accuracy(updates, distinct, stage);
+            free_histograms();
+            continue;
+        }
+        unsigned long long sum, generic_sum;
+        long long allocs, generic_allocs;
+        double rate = run(updates, repeat, distinct, stage, merge, sum, allocs);
+        histogram_kernels = select_histogram_kernels(0, 0);
+        double generic_rate = run(updates, repeat, distinct, stage, merge, generic_sum, generic_allocs);
+        printf("ARRAY B: %d UPDATES/s: %f GENERIC/s: %f SPEEDUP: %.2f CHECKSUM: %016llx ALLOCS: %lld%s\n",
+            B, rate, generic_rate, rate / generic_rate, sum, allocs + generic_allocs, (sum == generic_sum) ? "" : " MISMATCH");
+        free_histograms();
+    }
+    return 0;
+}
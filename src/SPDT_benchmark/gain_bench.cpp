@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+#include "../SPDT_general/gain.h"
+#include "../SPDT_general/timing.h"
+
+/*
+ * Microbenchmark of the gain kernels.
+ * Evaluate features of `candidates` sorted split candidates each, as
+ * sweep_gains hands them over, with every kernel the CPU supports. Report
+ * candidates per second and the largest difference from the scalar kernel.
+ * usage: ./gain-bench [-c candidates] [-f features] [-r repeat]
+ */
+
+int num_of_features = 1;
+int num_of_classes = 2;
+int max_bin_size = -1;
+int max_num_leaves = 1;
+int NUM_OF_THREAD = 1;
+
+static unsigned long long seed = 42;
+
+static float next_uniform() {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned int) (seed >> 33) / 2147483648.0f;
+}
+
+int main(int argc, char **argv) {
+    int candidates = 63;
+    int features = 1000;
+    int repeat = 200;
+    int c;
+    while((c = getopt(argc, argv, "c:f:r:")) != -1 ){
+        switch (c)
+        {
+        case 'c':
+            candidates = (int)std::atoi(optarg);
+            break;
+        case 'f':
+            features = (int)std::atoi(optarg);
+            break;
+        case 'r':
+            repeat = (int)std::atoi(optarg);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // a node of 100000 rows; per feature increasing left sums of both classes
+    double total = 100000;
+    vector<double> sums_0(features), sums_1(features);
+    vector<float> left_0((long long) features * candidates), left_1((long long) features * candidates);
+    for (int f = 0; f < features; f++) {
+        double pos_rate = 0.05 + 0.9 * next_uniform();
+        sums_0[f] = total * (1 - pos_rate);
+        sums_1[f] = total * pos_rate;
+        float l0 = 0, l1 = 0;
+        for (int k = 0; k < candidates; k++) {
+            l0 += next_uniform() * 2 * sums_0[f] / (candidates + 1);
+            l1 += next_uniform() * 2 * sums_1[f] / (candidates + 1);
+            left_0[(long long) f * candidates + k] = (l0 < sums_0[f]) ? l0 : sums_0[f];
+            left_1[(long long) f * candidates + k] = (l1 < sums_1[f]) ? l1 : sums_1[f];
+        }
+    }
+    double entropy = 1.0;
+
+    const char* names[] = {"scalar", "sse4.2", "avx2", "avx512"};
+    vector<float> reference((long long) features * candidates), gains((long long) features * candidates);
+    for (int isa = GAIN_ISA_SCALAR; isa <= GAIN_ISA_AVX512; isa++) {
+        gain_kernel_t kernel = select_gain_kernel(isa);
+        if (isa > GAIN_ISA_SCALAR && kernel == select_gain_kernel(isa - 1)) continue; // not supported
+        double best = 1e30;
+        for (int r = 0; r < repeat; r++) {
+            Timer t = Timer();
+            for (int f = 0; f < features; f++) {
+                long long first = (long long) f * candidates;
+                kernel(candidates, total, sums_0[f], sums_1[f], entropy,
+                       left_0.data() + first, left_1.data() + first, gains.data() + first);
+            }
+            double elapsed = t.elapsed();
+            if (elapsed < best) best = elapsed;
+        }
+        if (isa == GAIN_ISA_SCALAR) reference = gains;
+        double max_diff = 0;
+        for (size_t i = 0; i < gains.size(); i++) {
+            double d = fabs((double) gains[i] - reference[i]);
+            if (d > max_diff) max_diff = d;
+        }
+        printf("GAIN ISA: %s CANDIDATES/s: %f MAX_DIFF: %g\n", names[isa], (double) features * candidates / best, max_diff);
+    }
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+#include "../SPDT_general/parser.h"
+#include "../SPDT_general/timing.h"
+
+/*
+ * Microbenchmark of the LIBSVM reader.
+ * Stream a whole file through Dataset::streaming_read_data and report MB/s.
+ * usage: ./parser-bench -f ./data/a1a.train.txt [-b batch_size] [-r repeat] [-n threads] [-c] [-p] [-w ms]
+ * -n parses each batch on that many threads.
+ * -c loads the binary cache (written by the first run with -c) instead of parsing text.
+ * -p parses the next batch in the background, -w sleeps for `ms` per batch to stand
+ * in for training; with both, TIME approaches max(parse, work) instead of their sum.
+ * The background reader parses on one thread whatever -n says, so only the first
+ * batch uses -n threads under -p; compare -n 4 -p against -n 4 to see the cost.
+ */
+
+int num_of_features = -1;
+int num_of_classes = 2;
+int max_bin_size = -1;
+int max_num_leaves = -1;
+int NUM_OF_THREAD = 1;
+
+int main(int argc, char **argv) {
+    string name = "./data/a1a.train.txt";
+    int batch_size = 65536;
+    int repeat = 3;
+    bool use_cache = false;
+    bool use_prefetch = false;
+    double work_ms = 0;
+    int c;
+    while((c = getopt(argc, argv, "f:b:r:n:cpw:")) != -1 ){
+        switch (c)
+        {
+        case 'f':
+            name = optarg;
+            break;
+        case 'b':
+            batch_size = (int)std::atoi(optarg);
+            break;
+        case 'r':
+            repeat = (int)std::atoi(optarg);
+            break;
+        case 'n':
+            NUM_OF_THREAD = (int)std::atoi(optarg);
+            break;
+        case 'c':
+            use_cache = true;
+            break;
+        case 'p':
+            use_prefetch = true;
+            break;
+        case 'w':
+            work_ms = std::atof(optarg);
+            break;
+        default:
+            break;
+        }
+    }
+
+    double best = 1e30;
+    double mb = 0;
+    long long rows = 0;
+    long long nonzeros = 0;
+    double storage_mb = 0;
+    for (int r = 0; r < repeat; r++) {
+        Dataset dataset(0x7fffffff);
+        dataset.use_binary_cache = use_cache;
+        dataset.use_prefetch = use_prefetch;
+        Timer t = Timer();
+        dataset.open_read_data(name);
+        int64_t size = 0, mtime = 0;
+        file_signature(name, size, mtime);
+        mb = size / 1024.0 / 1024.0;
+        rows = 0;
+        nonzeros = 0;
+        bool hasNext = true;
+        while (hasNext) {
+            hasNext = dataset.streaming_read_data(batch_size);
+            std::this_thread::sleep_for(std::chrono::microseconds((long long) (work_ms * 1000)));
+            rows += dataset.dataset.size();
+            for (auto &d : dataset.dataset)
+                nonzeros += d.num_values;
+            RowStore& r = dataset.rows;
+            storage_mb = (r.labels.capacity() * sizeof(int) + r.row_offset.capacity() * sizeof(long long)
+                + r.feature_index.capacity() * sizeof(int) + r.feature_value.capacity() * sizeof(float)
+                + dataset.dataset.capacity() * sizeof(Data)) / 1024.0 / 1024.0;
+        }
+        dataset.close_read_data();
+        double elapsed = t.elapsed();
+        if (elapsed < best) best = elapsed;
+    }
+
+    printf("PARSER FILE: %s\n", name.c_str());
+    printf("PARSER ROWS: %lld\n", rows);
+    printf("PARSER NONZEROS: %lld\n", nonzeros);
+    printf("PARSER SIZE_MB: %f\n", mb);
+    printf("PARSER BATCH_STORAGE_MB: %f\n", storage_mb);
+    printf("PARSER THREADS: %d\n", NUM_OF_THREAD);
+    printf("PARSER PREFETCH: %d\n", use_prefetch);
+    printf("PARSER WORK_MS: %f\n", work_ms);
+    printf("PARSER TIME: %f\n", best);
+    printf("PARSER MB/s: %f\n", mb / best);
+    printf("PARSER ROWS/s: %f\n", rows / best);
+    return 0;
+}
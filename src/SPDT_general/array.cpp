@@ -1,197 +1,399 @@
 #include "tree.h"
 #include "array.h"
+#include <algorithm>
+#include <functional>
 
-float* histogram = NULL;
+LeafHistograms* histogram_leaves = NULL;
+HistogramLayout histogram_layout;
+int histogram_lane = 0;
+HistogramPoolStats histogram_pool_stats;
 
-/*
- * For A[][M][N][Z]
- * A[i][j][k][e] = A[N*Z*M*i+Z*N*j+k*Z+e]
- */
-int RLOC(int i, int j, int k, int e, int M, int N, int Z){
-    return N*Z*M*i + Z*N*j + k*Z+e;
+// histogram_ids the pool was set up for
+static int pool_leaves = 0;
+// chunks given back by leaves
+static std::vector<char*> pool_free;
+
+static long long align_bytes(long long bytes) {
+	return (bytes + HISTOGRAM_ALIGN - 1) / HISTOGRAM_ALIGN * HISTOGRAM_ALIGN;
 }
 
-/*
- * For A[][M][N][Z]
- * A[i][j][k] = A[N*Z*M*i+Z*N*j+k*Z]
- */
-int RLOC(int i, int j, int k, int M, int N, int Z){
-    return N*Z*M*i + Z*N*j + Z*k;
+long long checked_mul(long long a, long long b, const char *what) {
+	long long product;
+	if (a < 0 || b < 0 || __builtin_mul_overflow(a, b, &product)) {
+		fprintf(stderr, "ERROR: %s overflows (%lld * %lld)\n", what, a, b);
+		exit(-1);
+	}
+	return product;
 }
 
-/*
- * For A[][M][N][Z]
- * A[i][j] = A[N*Z*M*i+Z*N*j]
- */
-int RLOC(int i, int j, int M, int N, int Z){
-    return N*Z*M*i+Z*N*j;
+long long alloc_histograms(int max_leaves) {
+	free_histograms();
+	histogram_lane = lane_floats(max_bin_size);
+	histogram_kernels = select_histogram_kernels(max_bin_size, num_of_classes);
+	HistogramLayout &l = histogram_layout;
+	long long offset = 0;
+	l.size = offset;
+	offset += num_of_classes * sizeof(int32_t);
+	l.nonzeros = offset;
+	offset += num_of_classes * sizeof(int32_t);
+	l.stage_count = offset;
+	offset += num_of_classes * sizeof(uint8_t);
+	l.header = offset;
+	offset = l.lanes = align_bytes(offset);
+	offset = l.prefix = align_bytes(offset + checked_mul(num_of_classes, 2 * histogram_lane * sizeof(float), "histogram lanes"));
+	offset = l.stage = align_bytes(offset + checked_mul(num_of_classes, (max_bin_size + 2) * sizeof(uint64_t), "histogram prefix arrays"));
+	l.bytes = align_bytes(offset + num_of_classes * HISTOGRAM_STAGE_SIZE * sizeof(float));
+	// a leaf may see every feature
+	checked_mul(checked_mul(max_leaves, num_of_features, "histogram pool"), l.bytes, "histogram pool");
+	histogram_leaves = new LeafHistograms[max_leaves]();
+	pool_leaves = max_leaves;
+	histogram_pool_stats.block_bytes = l.bytes;
+	return l.bytes;
 }
 
-/*
- * For A[][M][N][Z]
- * A[i] = A[N*Z*M*i]
- */
-int RLOC(int i, int M, int N, int Z){
-    return N*Z*M*i;
+void reserve_histograms(int max_leaves) {
+	if (max_leaves <= pool_leaves) return;
+	checked_mul(checked_mul(max_leaves, num_of_features, "histogram pool"), histogram_layout.bytes, "histogram pool");
+	LeafHistograms *leaves = new LeafHistograms[max_leaves]();
+	for (int j = 0; j < pool_leaves; j++)
+		leaves[j] = std::move(histogram_leaves[j]);
+	delete[] histogram_leaves;
+	histogram_leaves = leaves;
+	pool_leaves = max_leaves;
 }
 
-inline int get_bin_size(float* histo){
-	return (int)*histo;
+/* a chunk for a leaf, from the free list or newly allocated */
+static char *take_chunk(long long chunk) {
+	char *data;
+	#pragma omp critical(histogram_pool)
+	{
+		if (!pool_free.empty()) {
+			data = pool_free.back();
+			pool_free.pop_back();
+		} else {
+			data = (char*) aligned_alloc(HISTOGRAM_ALIGN, chunk);
+			if (data == NULL) {
+				fprintf(stderr, "alloc_histograms: out of memory (%lld bytes)\n", chunk);
+				exit(-1);
+			}
+			histogram_pool_stats.arena_bytes += chunk;
+		}
+		histogram_pool_stats.in_use_bytes += chunk;
+		histogram_pool_stats.peak_bytes = std::max(histogram_pool_stats.peak_bytes, histogram_pool_stats.in_use_bytes);
+	}
+	return data;
 }
 
-inline int increase_bin_size(float* histo){
-	return (*histo) += 1.f;
+static long long chunk_bytes() {
+	long long bytes = histogram_layout.bytes;
+	return std::max(HISTOGRAM_ARENA_CHUNK / bytes, 1LL) * bytes;
 }
 
-inline int decrease_bin_size(float* histo){
-	return (*histo) -= 1.f;
+/* a table of `entries` (a power of two) free entries */
+static void reset_table(LeafHistograms &leaf, int entries) {
+	leaf.keys.assign(entries, -1);
+	leaf.blocks.assign(entries, NULL);
+	leaf.shift = 32;
+	for (int n = entries; n > 1; n >>= 1) leaf.shift--;
 }
 
-float *get_histogram_array(int histogram_id, int feature_id, int label) {
-    return histogram + 
-        RLOC(histogram_id, feature_id, label, 0, 
-        num_of_features, num_of_classes, (max_bin_size + 1) * 2 + 1);
+static void insert_feature(LeafHistograms &leaf, int feature_id, char *block) {
+	uint32_t mask = leaf.keys.size() - 1;
+	uint32_t i = feature_hash(feature_id, leaf.shift);
+	while (leaf.keys[i] >= 0) i = (i + 1) & mask;
+	leaf.keys[i] = feature_id;
+	leaf.blocks[i] = block;
 }
 
-float *get_histogram_array(float *histo, int histogram_id, int feature_id, int label) {
-    return histo + 
-        RLOC(histogram_id, feature_id, label, 0, 
-        num_of_features, num_of_classes, (max_bin_size + 1) * 2 + 1);
+char *add_feature_block(int histogram_id, int feature_id) {
+	LeafHistograms &leaf = histogram_leaves[histogram_id];
+	long long bytes = histogram_layout.bytes;
+	if (leaf.next == NULL || leaf.end - leaf.next < bytes) {
+		long long chunk = chunk_bytes();
+		leaf.next = take_chunk(chunk);
+		leaf.end = leaf.next + chunk;
+		leaf.chunks.push_back(leaf.next);
+	}
+	char *block = leaf.next;
+	leaf.next += bytes;
+	memset(block, 0, histogram_layout.header);
+	#pragma omp atomic
+	histogram_pool_stats.zeroed_bytes += histogram_layout.header;
+	// keep the table at most half full
+	if (2 * (leaf.features.size() + 1) > leaf.keys.size()) {
+		std::vector<int32_t> keys;
+		std::vector<char*> blocks;
+		keys.swap(leaf.keys);
+		blocks.swap(leaf.blocks);
+		reset_table(leaf, 2 * keys.size());
+		for (size_t i = 0; i < keys.size(); i++)
+			if (keys[i] >= 0) insert_feature(leaf, keys[i], blocks[i]);
+	}
+	insert_feature(leaf, feature_id, block);
+	leaf.features.push_back(feature_id);
+	return block;
 }
 
-inline float get_bin_freq(float *histo, int index) {
-    return *(histo + index * 2 + 1);
+long long acquire_histograms(int num_leaves) {
+	assert(num_leaves <= pool_leaves);
+	long long bytes = 0;
+	for (int j = 0; j < num_leaves; j++)
+		bytes += acquire_histogram(j);
+	return bytes;
 }
 
-inline float get_bin_value(float *histo, int index) {
-    return *(histo + index * 2 + 2);
+long long acquire_histogram(int histogram_id) {
+	assert(histogram_id < pool_leaves);
+	release_histogram(histogram_id);
+	LeafHistograms &leaf = histogram_leaves[histogram_id];
+	reset_table(leaf, HISTOGRAM_TABLE_MIN);
+	leaf.features.clear();
+	long long bytes = HISTOGRAM_TABLE_MIN * (sizeof(int32_t) + sizeof(char*));
+	#pragma omp atomic
+	histogram_pool_stats.zeroed_bytes += bytes;
+	return bytes;
 }
 
-inline void set_bin_freq(float *histo, int index, float freq) {
-    *(histo + index * 2 + 1) = freq;
+void release_histogram(int histogram_id) {
+	if (histogram_id < 0) return;
+	LeafHistograms &leaf = histogram_leaves[histogram_id];
+	if (leaf.chunks.empty()) return;
+	#pragma omp critical(histogram_pool)
+	{
+		pool_free.insert(pool_free.end(), leaf.chunks.begin(), leaf.chunks.end());
+		histogram_pool_stats.in_use_bytes -= leaf.chunks.size() * chunk_bytes();
+	}
+	leaf.chunks.clear();
+	leaf.next = leaf.end = NULL;
 }
 
-inline void set_bin_value(float *histo, int index, float value) {
-    *(histo + index * 2 + 2) = value;
+void free_histograms() {
+	for (int j = 0; j < pool_leaves; j++)
+		release_histogram(j);
+	for (char *chunk : pool_free)
+		free(chunk);
+	pool_free.clear();
+	delete[] histogram_leaves;
+	histogram_leaves = NULL;
+	pool_leaves = 0;
+	histogram_pool_stats = HistogramPoolStats();
 }
 
-int get_total_array(int histogram_id, int feature_id, int label) {
-    int t = 0;
-    float *histo = get_histogram_array(histogram_id, feature_id, label);
-    int bin_size = *histo;
-    for (int i = 0; i < bin_size; i++){
-        t += get_bin_freq(histo, i);
-    }
-    return t;
+BinArray get_histogram_array(int histogram_id, int feature_id, int label) {
+	return HistogramShape<0, 0>::histo(histogram_id, feature_id, label);
 }
 
-void print_array(float* histo){
+uint64_t *get_prefix_array(int histogram_id, int feature_id, int label) {
+	return HistogramShape<0, 0>::prefix(histogram_id, feature_id, label);
+}
+
+void print_array(BinArray histo){
 	int bin_size = get_bin_size(histo);
 	printf("size=%d, [", bin_size);
 	for(int i=0; i<bin_size; i++){
 		auto freq = get_bin_freq(histo, i);
 		auto value = get_bin_value(histo, i);
-		printf("(%.8f, %.f),", value, freq);
+		printf("(%.8f, %u),", value, freq);
 	}
 	printf("]\n");
 }
 
-float sum_array(int histogram_id, int feature_id, int label, float value) {	
+/*
+ * Binary search for the insert position of value:
+ * bins[index - 1].value <= value < bins[index].value
+ * (branch-free halving: the outcome of each comparison is unpredictable)
+ */
+inline int search_bin(BinArray histo, int bin_size, float value) {
 	int index = 0;
-	float mb = 0;
-	float s = 0;
+	for (int n = bin_size; n > 0; ) {
+		int half = n >> 1;
+		bool right = !(get_bin_value(histo, index + half) > value);
+		index = right ? index + half + 1 : index;
+		n = right ? n - half - 1 : half;
+	}
+	return index;
+}
 
-    float *histo = get_histogram_array(histogram_id, feature_id, label);
-    int bin_size = *histo;
+/*
+ * The first bin within EPS of value, or -1. Such bins are contiguous and
+ * next to the insert position `index`.
+ */
+inline int same_bin(BinArray histo, int bin_size, int index, float value) {
+	int same = -1;
+	for (int i = index - 1; i >= 0 && abs(get_bin_value(histo, i) - value) < EPS; i--)
+		same = i;
+	if (same < 0 && index < bin_size && abs(get_bin_value(histo, index) - value) < EPS)
+		same = index;
+	return same;
+}
 
-    // value < the first value in histo
-	if (value < get_bin_value(histo, 0)) {
-		return 0;
-	}
-	
-	if (bin_size == 1) {
-		return get_bin_freq(histo, 0);
-	}
+/*
+ * prefix[i] = freq of bins[0] + ... + freq of bins[i - 1], for i = 0..bin_size.
+ */
+void prefix_array(BinArray histo, uint64_t *prefix) {
+	int bin_size = get_bin_size(histo);
+	prefix[0] = 0;
+	for (int i = 0; i < bin_size; i++)
+		prefix[i + 1] = prefix[i] + get_bin_freq(histo, i);
+}
 
-    // value >= the last value in histogram
-	if (value >= get_bin_value(histo, bin_size - 1)) {
-		for (int i = 0; i < bin_size; i++) {
-			s += get_bin_freq(histo, i);			
+/* refresh the cumulative frequencies of every histogram of a leaf */
+void build_prefix_arrays(int histogram_id) {
+	for (int f : histogram_leaves[histogram_id].features) {
+		for (int c = 0; c < num_of_classes; c++) {
+			prefix_array(get_histogram_array(histogram_id, f, c), get_prefix_array(histogram_id, f, c));
 		}
-		return s;
 	}
+}
 
-	for (index = 0; index + 1 < bin_size; index++) {
-		if (get_bin_value(histo, index) <= value 
-            && get_bin_value(histo, index + 1) > value) {
-			break;
-		}
-	}		
+uint64_t get_total_array(int histogram_id, int feature_id, int label) {
+	BinArray histo = get_histogram_array(histogram_id, feature_id, label);
+	return get_prefix_array(histogram_id, feature_id, label)[get_bin_size(histo)];
+}
 
-	if (abs(get_bin_value(histo, index + 1) - get_bin_value(histo, index)) <= EPS) {
-		// printVector(vec);
-		printf("index: %d\n", index);
-		printf("value: %f\n", value);
-		exit(1);
+/*
+ * The sum procedure of Ben-Haim for bins[index].value <= value <
+ * bins[index + 1].value: the bins left of the pair from `prefix`, plus the
+ * trapezoid between the pair.
+ */
+inline float sum_between(BinArray histo, const uint64_t *prefix, int index, float value) {
+	float left = get_bin_value(histo, index), right = get_bin_value(histo, index + 1);
+	if (right - left <= EPS) {
+		fprintf(stderr, "sum_prefix: bins %d and %d are not apart (%f)\n", index, index + 1, value);
+		exit(-1);
 	}
 
-	if (abs(get_bin_value(histo, index + 1) - get_bin_value(histo, index)) > EPS) {
-		mb = get_bin_freq(histo, index + 1) - get_bin_freq(histo, index);
-		mb = mb * (value - get_bin_value(histo, index));
-		mb = mb / (get_bin_value(histo, index + 1) - get_bin_value(histo, index));
-		mb = get_bin_freq(histo, index) + mb;
-	} else {
-		fprintf(stderr, "abs(vec[index + 1].value - vec[index].value) > EPS");
-		exit(-1);		
+	float mb = (float) get_bin_freq(histo, index + 1) - (float) get_bin_freq(histo, index);
+	mb = mb * (value - left) / (right - left);
+	mb = get_bin_freq(histo, index) + mb;
+
+	float s = (get_bin_freq(histo, index) + mb) / 2;
+	s = s * (value - left) / (right - left);
+	s = s + prefix[index];
+	s = s + get_bin_freq(histo, index) / 2.f;
+	return s;
+}
+
+/*
+ * Estimated number of values <= `value`, O(log B).
+ * -1 when sum_between is needed: `value` lies within the bins.
+ */
+inline float sum_outside(BinArray histo, const uint64_t *prefix, float value) {
+	int bin_size = get_bin_size(histo);
+	// value < the first value in histo
+	if (bin_size == 0 || value < get_bin_value(histo, 0)) {
+		return 0;
+	}
+	if (bin_size == 1) {
+		return get_bin_freq(histo, 0);
 	}
-	
-	if (abs(get_bin_value(histo, index + 1) - get_bin_value(histo, index)) > EPS) {
-		s = (get_bin_freq(histo, index) + mb) / 2;
-		s = s * (value - get_bin_value(histo, index));
-		s = s / (get_bin_value(histo, index + 1) - get_bin_value(histo, index));
-	} else {
-		fprintf(stderr, "(vec[index + 1].value - vec[index].value) == 0");
-		exit(-1);		
+	// value >= the last value in histogram
+	if (value >= get_bin_value(histo, bin_size - 1)) {
+		return prefix[bin_size];
 	}
+	return -1;
+}
 
-	for (int j = 0; j < index; j++) {
-		s = s + get_bin_freq(histo, j);
-	}
+float sum_prefix(BinArray histo, const uint64_t *prefix, float value) {
+	float s = sum_outside(histo, prefix, value);
+	if (s >= 0) return s;
+	int index = search_bin(histo, get_bin_size(histo), value) - 1;
+	return sum_between(histo, prefix, index, value);
+}
 
-	s = s + ((float)get_bin_freq(histo, index)) / 2;	
-	return s;
+/*
+ * sum_prefix for values queried in increasing order: `cursor` (start at 0)
+ * only moves forward, so a sweep over the bins costs O(B) in all.
+ */
+float sum_prefix(BinArray histo, const uint64_t *prefix, float value, int &cursor) {
+	float s = sum_outside(histo, prefix, value);
+	if (s >= 0) return s;
+	int bin_size = get_bin_size(histo);
+	while (cursor + 2 < bin_size && get_bin_value(histo, cursor + 1) <= value) cursor++;
+	return sum_between(histo, prefix, cursor, value);
+}
+
+template <int BINS, int CLASSES>
+float sum_array_kernel(int histogram_id, int feature_id, int label, float value) {
+	typedef HistogramShape<BINS, CLASSES> Shape;
+	return sum_prefix(Shape::histo(histogram_id, feature_id, label),
+		Shape::prefix(histogram_id, feature_id, label), value);
 }
 
-void merge_same_array(float *histo) {
-    int bin_size = *histo;
-    for (int i = 0; i + 1 < bin_size; i++) {        
+/*
+ * Remove bins[index] from the bin array by shifting the tail left.
+ */
+inline void erase_bin(BinArray histo, int index, int bin_size) {
+	memmove(histo.value + index, histo.value + index + 1, (bin_size - index - 1) * sizeof(float));
+	memmove(histo.freq + index, histo.freq + index + 1, (bin_size - index - 1) * sizeof(uint32_t));
+}
+
+/*
+ * Join the bins within EPS of each other, among the pairs (index - 1, index)
+ * and (index, index + 1) only. Adjacent bins are otherwise always more than
+ * EPS apart, so after bin `index` changed only these pairs can collapse.
+ */
+void merge_same_neighbors(BinArray histo, int index) {
+	int bin_size = get_bin_size(histo);
+	int i = (index > 0) ? index - 1 : 0;
+	while (i <= index && i + 1 < bin_size) {
 		if (abs(get_bin_value(histo, i) - get_bin_value(histo, i + 1)) < EPS) {
-			set_bin_freq(histo, i, get_bin_freq(histo, i) + get_bin_freq(histo, i + 1));			
-			
-            // erase vec[i + 1]
-			for (int j = i + 1; j <= bin_size - 2; j++) {
-                set_bin_freq(histo, j, get_bin_freq(histo, j + 1));
-                set_bin_value(histo, j, get_bin_value(histo, j + 1));
-			}
+			// keep bins[i] and compare it with its new neighbor again
+			set_bin_freq(histo, i, get_bin_freq(histo, i) + get_bin_freq(histo, i + 1));
+			erase_bin(histo, i + 1, bin_size);
 			bin_size--;
-			i--;
+		} else {
+			i++;
 		}
 	}
-    *histo = (float) bin_size;
+	set_bin_size(histo, bin_size);
 }
 
-void merge_bin_array(float *histo) {    
+/*
+ * Index of the (first) smallest gap between adjacent bins. When an insert
+ * overflowed a histogram of BINS bins there are exactly BINS gaps: they are
+ * then computed and reduced in fixed-length loops that the compiler
+ * vectorizes. The gaps are non-negative, so they order like their bit
+ * patterns as ints, and the int min needs no fast-math. Below 32 bins the
+ * plain scan is as fast.
+ */
+template <int BINS>
+inline int min_gap_index(BinArray histo, int bin_size) {
+	if (BINS >= 32 && bin_size == BINS + 1) {
+		int32_t gap[BINS ? BINS : 1];
+		for (int i = 0; i < BINS; i++) {
+			float g = get_bin_value(histo, i + 1) - get_bin_value(histo, i);
+			memcpy(gap + i, &g, sizeof(g));
+		}
+		int32_t min_gap = gap[0];
+		for (int i = 1; i < BINS; i++)
+			min_gap = (gap[i] < min_gap) ? gap[i] : min_gap;
+		int index = 0;
+		while (gap[index] != min_gap) index++;
+		return index;
+	}
+	// find the (first) min value of difference in one pass
 	int index = 0;
-    float new_freq = 0;
-    float new_value = 0;
-    int bin_size = get_bin_size(histo);
-	// find the min value of difference
-	for (int i = 0; i < bin_size - 1; i++) {
-		if (get_bin_value(histo, i + 1) - get_bin_value(histo, i)
-			< get_bin_value(histo, index + 1) - get_bin_value(histo, index)) {
+	float min_gap = get_bin_value(histo, 1) - get_bin_value(histo, 0);
+	float prev = get_bin_value(histo, 1);
+	for (int i = 1; i < bin_size - 1; i++) {
+		float next = get_bin_value(histo, i + 1);
+		float gap = next - prev;
+		if (gap < min_gap) {
+			min_gap = gap;
 			index = i;
 		}
+		prev = next;
 	}
+	return index;
+}
+
+template <int BINS>
+void merge_bin_array(BinArray histo) {    
+    uint32_t new_freq = 0;
+    float new_value = 0;
+    int bin_size = get_bin_size(histo);
+	int index = min_gap_index<BINS>(histo, bin_size);
 
 	// merge bins[index], bins[index + 1] into a new element
 	new_freq = get_bin_freq(histo, index) + get_bin_freq(histo, index + 1);
@@ -204,37 +406,258 @@ void merge_bin_array(float *histo) {
     set_bin_value(histo, index, new_value);
 
 	// erase vec[index + 1]
-	for (int i = index + 1; i <= bin_size - 2; i++) {
-        set_bin_freq(histo, i, get_bin_freq(histo, i + 1));
-        set_bin_value(histo, i, get_bin_value(histo, i + 1));
- 	}
+	erase_bin(histo, index + 1, bin_size);
 	bin_size--;
-	decrease_bin_size(histo);
-    merge_same_array(histo);
+	set_bin_size(histo, bin_size);
+    merge_same_neighbors(histo, index);
+}
+
+/*
+ * Merge the closest adjacent bins until at most `max_bins` are left, with the
+ * same result as calling merge_bin_array that many times. Instead of one O(B)
+ * scan per merge, the gaps are kept in a heap and the bins in a linked list,
+ * so that shrinking by m bins costs O(B + m log B).
+ */
+void shrink_array(BinArray histo, int max_bins) {
+	int n = get_bin_size(histo);
+	if (n <= max_bins) return;
+	// a few merges are cheaper as plain scans
+	if (n - max_bins <= SHRINK_SCAN_MERGES) {
+		while (get_bin_size(histo) > max_bins) merge_bin_array<0>(histo);
+		return;
+	}
+
+	struct Gap {
+		float gap;
+		int left;
+		// min-heap on gap, the leftmost pair first among equal gaps
+		bool operator < (const Gap& g) const {
+			return gap > g.gap || (gap == g.gap && left > g.left);
+		}
+	};
+	// per-thread buffers, bound to locals once (thread_local access is not free)
+	static thread_local vector<float> value_buf;
+	static thread_local vector<uint32_t> freq_buf;
+	static thread_local vector<int> prev_buf, next_buf;
+	static thread_local vector<Gap> heap_buf;
+	value_buf.resize(n);
+	freq_buf.resize(n);
+	prev_buf.resize(n);
+	next_buf.resize(n);
+	float *value = value_buf.data();
+	uint32_t *freq = freq_buf.data();
+	int *prev = prev_buf.data(), *next = next_buf.data();
+	vector<Gap>& heap = heap_buf;
+	heap.clear();
+	for (int i = 0; i < n; i++) {
+		value[i] = get_bin_value(histo, i);
+		freq[i] = get_bin_freq(histo, i);
+		prev[i] = i - 1;
+		next[i] = (i + 1 < n) ? i + 1 : -1;
+		if (i > 0) heap.push_back({value[i] - value[i - 1], i - 1});
+	}
+	make_heap(heap.begin(), heap.end());
+	auto push_gap = [&](int i) {
+		if (i < 0 || next[i] < 0) return;
+		heap.push_back({value[next[i]] - value[i], i});
+		push_heap(heap.begin(), heap.end());
+	};
+	// bins[0] is never removed; a removed bin gets next == -2
+	auto unlink = [&](int j) {
+		next[prev[j]] = next[j];
+		if (next[j] >= 0) prev[next[j]] = prev[j];
+		next[j] = -2;
+	};
+
+	int size = n;
+	while (size > max_bins) {
+		pop_heap(heap.begin(), heap.end());
+		Gap g = heap.back();
+		heap.pop_back();
+		// stale unless it is still the gap of a live bin to its successor
+		int i = g.left, j = next[i];
+		if (j < 0 || value[j] - value[i] != g.gap)
+			continue;
+
+		// merge bins[i], bins[j] into a new element
+		uint32_t new_freq = freq[i] + freq[j];
+		value[i] = (value[i] * freq[i] + value[j] * freq[j]) / new_freq;
+		freq[i] = new_freq;
+		unlink(j);
+		size--;
+
+		// as merge_same_neighbors: the pairs at the positions of prev(i) and i
+		int node = (prev[i] >= 0) ? prev[i] : i;
+		int positions = (prev[i] >= 0) ? 2 : 1;
+		while (positions > 0 && next[node] >= 0) {
+			int k = next[node];
+			if (abs(value[node] - value[k]) < EPS) {
+				freq[node] += freq[k];
+				unlink(k);
+				size--;
+			} else {
+				push_gap(node);
+				node = k;
+				positions--;
+			}
+		}
+		// the loop pushed the gaps that changed; those it did not reach are
+		// still in the heap
+	}
+
+	int k = 0;
+	for (int i = 0; i >= 0 && k < size; i = next[i], k++) {
+		set_bin_value(histo, k, value[i]);
+		set_bin_freq(histo, k, freq[i]);
+	}
+	set_bin_size(histo, size);
+}
+
+/*
+ * One-pass version of shrink_array for a batch: merge away the m smallest
+ * gaps at once (the leftmost among equal ones), i.e. every run of adjacent
+ * bins joined by such gaps becomes one bin at their weighted mean.
+ * Bins that end up within EPS of each other are joined as well.
+ */
+void fold_array(BinArray histo, int max_bins) {
+	int n = get_bin_size(histo);
+	int m = n - max_bins;
+	if (m <= 0) return;
+	static thread_local vector<float> gap_buf, sorted_buf;
+	vector<float>& gap = gap_buf;
+	vector<float>& sorted = sorted_buf;
+	gap.resize(n - 1);
+	for (int i = 0; i + 1 < n; i++)
+		gap[i] = get_bin_value(histo, i + 1) - get_bin_value(histo, i);
+	sorted.assign(gap.begin(), gap.end());
+	nth_element(sorted.begin(), sorted.begin() + (m - 1), sorted.end());
+	float cut = sorted[m - 1];
+	int below = 0;
+	for (int i = 0; i + 1 < n; i++) below += (gap[i] < cut);
+	int ties = m - below;
+
+	int size = 0;
+	float value = get_bin_value(histo, 0) * get_bin_freq(histo, 0);
+	uint32_t freq = get_bin_freq(histo, 0);
+	for (int i = 1; i <= n; i++) {
+		bool join = false;
+		if (i < n) {
+			join = gap[i - 1] < cut || (gap[i - 1] == cut && ties > 0);
+			if (gap[i - 1] == cut && join) ties--;
+		}
+		if (join) {
+			value += get_bin_value(histo, i) * get_bin_freq(histo, i);
+			freq += get_bin_freq(histo, i);
+			continue;
+		}
+		float v = value / freq;
+		if (size > 0 && abs(get_bin_value(histo, size - 1) - v) < EPS) {
+			set_bin_freq(histo, size - 1, get_bin_freq(histo, size - 1) + freq);
+		} else {
+			set_bin_value(histo, size, v);
+			set_bin_freq(histo, size, freq);
+			size++;
+		}
+		if (i < n) {
+			value = get_bin_value(histo, i) * get_bin_freq(histo, i);
+			freq = get_bin_freq(histo, i);
+		}
+	}
+	set_bin_size(histo, size);
+}
+
+/*
+ * Insert n values at once (`values` is overwritten). Values that fall into an
+ * existing bin (within EPS) only bump its frequency; the others are sorted,
+ * folded into the bins with one linear merge, and the result is brought back
+ * to max_bin_size with a single fold_array.
+ */
+template <int BINS, int CLASSES>
+void update_array_batch_kernel(int histogram_id, int feature_id, int label, float *values, int n) {
+	typedef HistogramShape<BINS, CLASSES> Shape;
+	static thread_local BinBuffer merged_buf;
+	BinArray histo = Shape::histo(histogram_id, feature_id, label);
+	int bin_size = get_bin_size(histo);
+	int fresh = 0;
+	for (int k = 0; k < n; k++) {
+		int same = same_bin(histo, bin_size, search_bin(histo, bin_size, values[k]), values[k]);
+		if (same >= 0)
+			set_bin_freq(histo, same, get_bin_freq(histo, same) + 1);
+		else
+			values[fresh++] = values[k];
+	}
+	if (fresh == 0) return;
+	n = fresh;
+	sort(values, values + n);
+	BinArray out = merged_buf.bins(bin_size + n);
+	int size = 0, i = 0, k = 0;
+	// whether the last output bin holds an existing bin, whose value then stays
+	bool last_is_bin = false;
+	while (i < bin_size || k < n) {
+		float value;
+		uint32_t freq;
+		bool is_bin = (k >= n || (i < bin_size && get_bin_value(histo, i) <= values[k]));
+		if (is_bin) {
+			value = get_bin_value(histo, i);
+			freq = get_bin_freq(histo, i);
+			i++;
+		} else {
+			value = values[k];
+			freq = 1;
+			k++;
+		}
+		if (size > 0 && abs(get_bin_value(out, size - 1) - value) < EPS) {
+			set_bin_freq(out, size - 1, get_bin_freq(out, size - 1) + freq);
+			if (is_bin && !last_is_bin) {
+				set_bin_value(out, size - 1, value);
+				last_is_bin = true;
+			}
+		} else {
+			set_bin_value(out, size, value);
+			set_bin_freq(out, size, freq);
+			size++;
+			last_is_bin = is_bin;
+		}
+	}
+	set_bin_size(out, size);
+	fold_array(out, Shape::bins());
+	copy_array(histo, out);
+}
+
+/* copy the bins of src into dst, which has room for them */
+void copy_array(BinArray dst, BinArray src) {
+	int bin_size = get_bin_size(src);
+	memcpy(dst.value, src.value, bin_size * sizeof(float));
+	memcpy(dst.freq, src.freq, bin_size * sizeof(uint32_t));
+	set_bin_size(dst, bin_size);
 }
 
 /*
  * merge histo1 with histo2.
  * Write the results in histo1.
+ * With BINS known the merged bins are kept on the stack.
 */
-void merge_array_pointers(float *histo1, float *histo2) {
-    int bin_size1 = *histo1;
-    int bin_size2 = *histo2;
+template <int BINS>
+void merge_array_kernel(BinArray histo1, BinArray histo2) {
+    int bin_size1 = get_bin_size(histo1);
+    int bin_size2 = get_bin_size(histo2);
 	if (bin_size2 == 0)
 		return;
 	if (bin_size1 == 0){
-		for(int k=0; k< bin_size2; k++){
-			set_bin_freq(histo1, k, get_bin_freq(histo2, k));
-			set_bin_value(histo1, k, get_bin_value(histo2, k));
-		}
-		*histo1 = (float) bin_size2;
+		copy_array(histo1, histo2);
 		return;
 	}
     int bin_size_merge = 0;
     int index1 = 0, index2 = 0;
-    float *histo_merge = new float[max_bin_size * 4 + 1]; //TODO: optimize
+    static thread_local BinBuffer merge_buf;
+    int32_t stack_size;
+    float stack_values[BINS ? 2 * BINS : 1];
+    uint32_t stack_counts[BINS ? 2 * BINS : 1];
+    BinArray histo_merge = (BINS && bin_size1 + bin_size2 <= 2 * BINS)
+        ? make_bin_array(&stack_size, stack_values, stack_counts)
+        : merge_buf.bins(bin_size1 + bin_size2);
     while (index1 < bin_size1 || index2 < bin_size2) {
-		float freq;
+		uint32_t freq;
 		float value;
 		if (index1 >= bin_size1){
 			freq = get_bin_freq(histo2, index2);
@@ -269,68 +692,135 @@ void merge_array_pointers(float *histo1, float *histo2) {
 			bin_size_merge++;
 		}
     }
-	*histo_merge = (float) bin_size_merge;
-
-	// merge the same values in vec
-	// merge_same_array(histo_merge);
+	set_bin_size(histo_merge, bin_size_merge);
 
-	while (bin_size_merge > max_bin_size) {
-		merge_bin_array(histo_merge);
-		bin_size_merge --;		
-	}
+	shrink_array(histo_merge, HistogramShape<BINS, 0>::bins());
 
     // copy from histo_merge into histo1    
-    *histo1 = (float) bin_size_merge;
-    for (int i = 0; i < bin_size_merge; i++) {
-        set_bin_freq(histo1, i, get_bin_freq(histo_merge, i));
-        set_bin_value(histo1, i, get_bin_value(histo_merge, i));
-    }
-	delete []histo_merge;
+    copy_array(histo1, histo_merge);
 	return;
 }
 
+/*
+ * Merge the n histograms in[0, n) into `out`, which may be one of them, in a
+ * single sweep: a heap yields the bins of all of them in increasing value
+ * order, a bin within EPS of the last merged one is added to it, and the
+ * result is brought back to max_bin_size by one shrink_array. For three or
+ * more inputs the bins are not those of a chain of pairwise merges, which
+ * shrinks after every step, but those of compressing the union once.
+ * Two histograms go through merge_array_pointers, which is the same merge.
+ */
+void merge_arrays(BinArray out, const BinArray *in, int n) {
+	if (n == 1) {
+		if (out.value != in[0].value) copy_array(out, in[0]);
+		return;
+	}
+	if (n == 2) {
+		int other = (out.value == in[1].value) ? 0 : 1;
+		if (out.value != in[0].value && out.value != in[1].value) copy_array(out, in[0]);
+		merge_array_pointers(out, in[other]);
+		return;
+	}
+	static thread_local BinBuffer merge_buf;
+	static thread_local std::vector<std::pair<float, int> > heap;
+	static thread_local std::vector<int> cursor;
+	std::greater<std::pair<float, int> > later;
+	long long total = 0;
+	heap.clear();
+	cursor.assign(n, 0);
+	for (int i = 0; i < n; i++) {
+		total += get_bin_size(in[i]);
+		if (get_bin_size(in[i]) > 0) heap.push_back(std::make_pair(get_bin_value(in[i], 0), i));
+	}
+	std::make_heap(heap.begin(), heap.end(), later);
+	BinArray merged = merge_buf.bins(total);
+	int size = 0;
+	while (!heap.empty()) {
+		std::pop_heap(heap.begin(), heap.end(), later);
+		float value = heap.back().first;
+		int i = heap.back().second;
+		uint32_t freq = get_bin_freq(in[i], cursor[i]);
+		if (++cursor[i] < get_bin_size(in[i])) {
+			heap.back().first = get_bin_value(in[i], cursor[i]);
+			std::push_heap(heap.begin(), heap.end(), later);
+		} else {
+			heap.pop_back();
+		}
+		if (size > 0 && abs(get_bin_value(merged, size - 1) - value) < EPS) {
+			set_bin_freq(merged, size - 1, get_bin_freq(merged, size - 1) + freq);
+		} else {
+			set_bin_value(merged, size, value);
+			set_bin_freq(merged, size, freq);
+			size++;
+		}
+	}
+	set_bin_size(merged, size);
+	shrink_array(merged, max_bin_size);
+	copy_array(out, merged);
+}
+
 void merge_array(int histogram_id1, int feature_id1, int label1, int histogram_id2, int feature_id2, int label2) {
-	float *histo1 = get_histogram_array(histogram_id1, feature_id1, label1);
-    float *histo2 = get_histogram_array(histogram_id2, feature_id2, label2);
-	merge_array_pointers(histo1, histo2);
+	BinArray histo1 = get_histogram_array(histogram_id1, feature_id1, label1);
+    BinArray histo2 = get_histogram_array(histogram_id2, feature_id2, label2);
+	histogram_kernels.merge(histo1, histo2);
 	return;
 }
 
-void uniform_array(std::vector<float> &u, int histogram_id, int feature_id, int label, float* histo) {	
-    int bin_size = get_bin_size(histo);
-    int B = bin_size;
-	float tmpsum = 0;
+/*
+ * The uniform procedure of Ben-Haim: B - 1 split candidates among the bins
+ * of the merged histogram `histo` of a feature, for B parts of its mass.
+ * As the split finding always did, the mass left of a bin is that of the
+ * histogram of class `label` of (histogram_id, feature_id), i.e. sum_array,
+ * read from its prefix array. The targets increase, so a single forward
+ * sweep locates them all, O(B) in all.
+ */
+template <int BINS, int CLASSES>
+void uniform_array_kernel(std::vector<float> &u, int histogram_id, int feature_id, int label, BinArray histo) {
+	typedef HistogramShape<BINS, CLASSES> Shape;
+	static thread_local std::vector<float> sums_buf;
+	float stack_sums[BINS ? BINS + 1 : 1];
+	int bin_size = get_bin_size(histo);
+	int B = bin_size;
 	float s = 0;
 	int index = 0;
-	float a = 0, b = 0, c = 0, d = 0, z = 0;	
+	float a = 0, b = 0, c = 0, d = 0, z = 0;
 	float uj = 0;
 	u.clear();
 
 	if (bin_size <= 1) {
 		return;
 	}
-	
+
+	float *sums = stack_sums;
+	if (!BINS || bin_size > BINS + 1) {
+		sums_buf.resize(bin_size);
+		sums = sums_buf.data();
+	}
+	// sum_array at the bins, which are in increasing order
+	BinArray by = Shape::histo(histogram_id, feature_id, label);
+	const uint64_t *by_prefix = Shape::prefix(histogram_id, feature_id, label);
+	int cursor = 0;
+	uint64_t total = 0;
 	for (int i = 0; i < bin_size; i++) {
-		tmpsum += get_bin_freq(histo, i);
-	}	
+		sums[i] = sum_prefix(by, by_prefix, get_bin_value(histo, i), cursor);
+		total += get_bin_freq(histo, i);
+	}
+	float tmpsum = total;
 
 	for (int j = 0; j <= B - 2; j++) {
-		s = tmpsum * (j + 1) / B;		
-		
-		for (index = 0; index + 1 < bin_size; index++) {
-			
-			if (sum_array(histogram_id, feature_id, label, get_bin_value(histo, index)) < s
-				&& s < sum_array(histogram_id, feature_id, label, get_bin_value(histo, index + 1))) {
-				break;
-			}
-		}
+		s = tmpsum * (j + 1) / B;
+
+		// the first index with sums[index] < s < sums[index + 1]; a target
+		// past the last sum (the class holds less than the merged mass)
+		// stays within the bins at bin_size - 2
+		while (index + 2 < bin_size && sums[index + 1] <= s) index++;
+
+		d = s - sums[index];
 
-		d = s - sum_array(histogram_id, feature_id, label, get_bin_value(histo, index));
+		a = (float) get_bin_freq(histo, index + 1) - (float) get_bin_freq(histo, index);
+		b = 2.f * get_bin_freq(histo, index);
+		c = -2 * d;
 
-		a = get_bin_freq(histo, index + 1) - get_bin_freq(histo, index);
-		b = 2 * get_bin_freq(histo, index);
-		c = -2 * d;		
-		
 		if (abs(a) > EPS && b * b - 4 * a * c >= 0) {
 			z = -b + sqrt(b * b - 4 * a * c);
 			z = z / (2 * a);
@@ -342,52 +832,222 @@ void uniform_array(std::vector<float> &u, int histogram_id, int feature_id, int
 		}
 		if (z < 0) z = 0;
 		if (z > 1) z = 1;
-		
-		uj = get_bin_value(histo, index) + z * (get_bin_value(histo, index + 1) - get_bin_value(histo, index));		
-		u.push_back(uj);				
+
+		uj = get_bin_value(histo, index) + z * (get_bin_value(histo, index + 1) - get_bin_value(histo, index));
+		u.push_back(uj);
 	}
-	
+
 	return;
 }
 
-void update_array(int histogram_id, int feature_id, int label, float value) {		
-	float *histo = get_histogram_array(histogram_id, feature_id, label);
-	// If there are values in the bin equals to the value here
-	int bin_size = get_bin_size(histo);
-	for (int i = 0; i < bin_size; i++) {
-		if (abs(get_bin_value(histo, i) - value) < EPS) {		
-			set_bin_freq(histo, i, get_bin_freq(histo, i)+1.f);
-			return;
+void pack_histograms(int num_leaves, std::vector<char> &buffer) {
+	size_t bytes = 0;
+	for (int j = 0; j < num_leaves; j++) {
+		bytes += sizeof(int32_t);
+		for (int f : histogram_leaves[j].features) {
+			bytes += sizeof(int32_t);
+			const int32_t *size = (int32_t*) (find_feature_block(j, f) + histogram_layout.size);
+			for (int c = 0; c < num_of_classes; c++)
+				bytes += sizeof(int32_t) + size[c] * (sizeof(float) + sizeof(uint32_t));
+		}
+	}
+	buffer.resize(bytes);
+	char *out = buffer.data();
+	for (int j = 0; j < num_leaves; j++) {
+		const std::vector<int> &features = histogram_leaves[j].features;
+		int32_t num_features = features.size();
+		memcpy(out, &num_features, sizeof(int32_t));
+		out += sizeof(int32_t);
+		for (int32_t f : features) {
+			memcpy(out, &f, sizeof(int32_t));
+			out += sizeof(int32_t);
+			for (int c = 0; c < num_of_classes; c++) {
+				BinArray histo = get_histogram_array(j, f, c);
+				int32_t bin_size = get_bin_size(histo);
+				memcpy(out, &bin_size, sizeof(int32_t));
+				out += sizeof(int32_t);
+				memcpy(out, histo.value, bin_size * sizeof(float));
+				out += bin_size * sizeof(float);
+				memcpy(out, histo.freq, bin_size * sizeof(uint32_t));
+				out += bin_size * sizeof(uint32_t);
+			}
+		}
+	}
+}
+
+void unpack_histograms(int num_leaves, const char *buffer, bool merge) {
+	BinBuffer packed(max_bin_size + 1);
+	for (int j = 0; j < num_leaves; j++) {
+		int32_t num_features;
+		memcpy(&num_features, buffer, sizeof(int32_t));
+		buffer += sizeof(int32_t);
+		for (int k = 0; k < num_features; k++) {
+			int32_t f;
+			memcpy(&f, buffer, sizeof(int32_t));
+			buffer += sizeof(int32_t);
+			for (int c = 0; c < num_of_classes; c++) {
+				int32_t bin_size;
+				memcpy(&bin_size, buffer, sizeof(int32_t));
+				buffer += sizeof(int32_t);
+				BinArray histo = merge ? packed.bins(bin_size) : get_histogram_array(j, f, c);
+				memcpy(histo.value, buffer, bin_size * sizeof(float));
+				buffer += bin_size * sizeof(float);
+				memcpy(histo.freq, buffer, bin_size * sizeof(uint32_t));
+				buffer += bin_size * sizeof(uint32_t);
+				set_bin_size(histo, bin_size);
+				if (merge)
+					merge_array_pointers(get_histogram_array(j, f, c), histo);
+			}
 		}
 	}
+}
 
-	// put the next element into the correct place in bin_size
-	// find the index to insert value
-	// bins[index - 1].value < value
-	// bins[index].value > value
-	int index = bin_size;	
+void merge_packed_histograms(int num_leaves, const char **buffers, int n) {
+	std::vector<const char*> in(buffers, buffers + n);
+	std::vector<BinBuffer> packed(n);
+	std::vector<BinArray> histos(n + 1);
+	for (int j = 0; j < num_leaves; j++) {
+		const std::vector<int> &features = histogram_leaves[j].features;
+		for (int i = 0; i < n; i++) {
+			int32_t num_features;
+			memcpy(&num_features, in[i], sizeof(int32_t));
+			in[i] += sizeof(int32_t);
+			assert(num_features == (int32_t) features.size());
+		}
+		for (int f : features) {
+			for (int i = 0; i < n; i++) {
+				int32_t packed_f;
+				memcpy(&packed_f, in[i], sizeof(int32_t));
+				in[i] += sizeof(int32_t);
+				assert(packed_f == f);
+			}
+			for (int c = 0; c < num_of_classes; c++) {
+				histos[0] = get_histogram_array(j, f, c);
+				for (int i = 0; i < n; i++) {
+					int32_t bin_size;
+					memcpy(&bin_size, in[i], sizeof(int32_t));
+					in[i] += sizeof(int32_t);
+					BinArray histo = packed[i].bins(bin_size);
+					memcpy(histo.value, in[i], bin_size * sizeof(float));
+					in[i] += bin_size * sizeof(float);
+					memcpy(histo.freq, in[i], bin_size * sizeof(uint32_t));
+					in[i] += bin_size * sizeof(uint32_t);
+					set_bin_size(histo, bin_size);
+					histos[i + 1] = histo;
+				}
+				merge_arrays(histos[0], histos.data(), n + 1);
+			}
+		}
+	}
+}
+
+/*
+ * Lay out `num_bins` bins with the given (increasing) values and no counts.
+ * The bins are then filled with add_bin_freq.
+ */
+void prelay_array(BinArray histo, const float *values, int num_bins) {
+	for (int i = 0; i < num_bins; i++) {
+		set_bin_freq(histo, i, 0);
+		set_bin_value(histo, i, values[i]);
+	}
+	set_bin_size(histo, num_bins);
+}
+
+/* remove the bins with a zero count */
+void compact_array(BinArray histo) {
+	int bin_size = get_bin_size(histo);
+	int n = 0;
 	for (int i = 0; i < bin_size; i++) {
-		if (get_bin_value(histo, i) > value) {
-			index = i;
-			break;
+		if (get_bin_freq(histo, i) > 0) {
+			set_bin_freq(histo, n, get_bin_freq(histo, i));
+			set_bin_value(histo, n, get_bin_value(histo, i));
+			n++;
 		}
 	}
-	// move the [index, bin_size - 1] an element further
-	for (int i = bin_size; i >= index + 1; i--) {
-		set_bin_value(histo, i, get_bin_value(histo, i-1));
-		set_bin_freq(histo, i, get_bin_freq(histo, i-1));
+	set_bin_size(histo, n);
+}
+
+/* insert `freq` copies of `value` at once */
+template <int BINS, int CLASSES>
+void update_array_kernel(int histogram_id, int feature_id, int label, float value, uint32_t freq) {
+	typedef HistogramShape<BINS, CLASSES> Shape;
+	BinArray histo = Shape::histo(histogram_id, feature_id, label);
+	int bin_size = get_bin_size(histo);
+
+	int index = search_bin(histo, bin_size, value);
+
+	// If there are values in the bin equals to the value here.
+	int same = same_bin(histo, bin_size, index, value);
+	if (same >= 0) {
+		set_bin_freq(histo, same, get_bin_freq(histo, same) + freq);
+		return;
 	}
 
+	// move the [index, bin_size - 1] an element further
+	memmove(histo.value + index + 1, histo.value + index, (bin_size - index) * sizeof(float));
+	memmove(histo.freq + index + 1, histo.freq + index, (bin_size - index) * sizeof(uint32_t));
+
 	bin_size++;
-	increase_bin_size(histo);
+	set_bin_size(histo, bin_size);
 
 	// put value into the place of bins[index]
 	set_bin_value(histo, index, value);
-	set_bin_freq(histo, index, 1.f);
-	if (bin_size <= max_bin_size) {
+	set_bin_freq(histo, index, freq);
+	if (bin_size <= Shape::bins()) {
 		return;
 	}
 
-	merge_bin_array(histo);	
+	merge_bin_array<BINS>(histo);
 	return;
-}
\ No newline at end of file
+}
+
+template <int BINS, int CLASSES>
+HistogramKernels histogram_kernels_for() {
+	HistogramKernels kernels = {
+		update_array_kernel<BINS, CLASSES>,
+		update_array_batch_kernel<BINS, CLASSES>,
+		merge_array_kernel<BINS>,
+		uniform_array_kernel<BINS, CLASSES>,
+		sum_array_kernel<BINS, CLASSES>,
+	};
+	return kernels;
+}
+
+HistogramKernels histogram_kernels = histogram_kernels_for<0, 0>();
+
+HistogramKernels select_histogram_kernels(int bins, int classes) {
+	if (classes == 2) {
+		switch (bins) {
+		case 16: return histogram_kernels_for<16, 2>();
+		case 32: return histogram_kernels_for<32, 2>();
+		case 64: return histogram_kernels_for<64, 2>();
+		case 128: return histogram_kernels_for<128, 2>();
+		case 256: return histogram_kernels_for<256, 2>();
+		}
+	}
+	return histogram_kernels_for<0, 0>();
+}
+
+float sum_array(int histogram_id, int feature_id, int label, float value) {
+	return histogram_kernels.sum(histogram_id, feature_id, label, value);
+}
+
+void merge_array_pointers(BinArray histo1, BinArray histo2) {
+	histogram_kernels.merge(histo1, histo2);
+}
+
+void uniform_array(std::vector<float> &u, int histogram_id, int feature_id, int label, BinArray histo) {
+	histogram_kernels.uniform(u, histogram_id, feature_id, label, histo);
+}
+
+void update_array(int histogram_id, int feature_id, int label, float value) {
+	histogram_kernels.update(histogram_id, feature_id, label, value, 1);
+}
+
+void update_array(int histogram_id, int feature_id, int label, float value, uint32_t freq) {
+	histogram_kernels.update(histogram_id, feature_id, label, value, freq);
+}
+
+void update_array_batch(int histogram_id, int feature_id, int label, float *values, int n) {
+	histogram_kernels.update_batch(histogram_id, feature_id, label, values, n);
+}
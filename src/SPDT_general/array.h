@@ -10,39 +10,307 @@
 #include <stdlib.h>
 
 // global variables
-// record the information of all histograms
-extern float* histogram;
+// histogram dimensions, defined with the trainer (tree.h)
+extern int num_of_features;
+extern int num_of_classes;
+extern int max_bin_size;
 
-void print_array(float* histo);
-float *get_histogram_array(int histogram_id, int feature_id, int label);
-float *get_histogram_array(float *histo, int histogram_id, int feature_id, int label);
-int get_total_array(int histogram_id, int feature_id, int label);
-float sum_array(int histogram_id, int feature_id, int label, float value);
-void merge_array_pointers(float *histo1, float *histo2);
-void merge_array(int histogram_id1, int feature_id1, int label1, int histogram_id2, int feature_id2, int label2);
-void uniform_array(std::vector<float> &u, int histogram_id, int feature_id, int label, float* histo);
-void update_array(int histogram_id, int feature_id, int label, float value);
+/*
+ * Histogram storage, struct-of-arrays. The bins of a histogram are a value
+ * lane (float) and a count lane (uint32) of histogram_lane entries each,
+ * next to each other and HISTOGRAM_ALIGN-byte aligned; the number of bins in
+ * use is an int32 apart from them. A lane holds up to max_bin_size + 1 bins:
+ * update_array inserts before it merges.
+ *
+ * Counts are integers so that a bin keeps counting past 2^24 samples, where
+ * a float frequency stops changing on += 1; cumulative counts are uint64.
+ * The bin frequencies ("freq") below are these counts.
+ */
+#define HISTOGRAM_ALIGN 64
+
+// values a histogram stages for update_array_batch, see compress.h
+#define HISTOGRAM_STAGE_SIZE 64
+
+/*
+ * A leaf only stores the histograms of the features that occur in its rows,
+ * so that its memory follows its nonzeros rather than num_of_features. Each
+ * such feature has a feature block with the histograms of all classes,
+ * found through an open-addressing table keyed by feature id. A feature
+ * missing from a leaf is 0 in all its rows: its only split has no gain.
+ *
+ * A feature block also keeps what compress counts for the feature, so that
+ * this is sparse too. histogram_layout has the byte offsets within a block;
+ * the arrays are indexed by class.
+ */
+struct HistogramLayout {
+	// int32 [class]: bins in use
+	int size;
+	// int32 [class]: stored values compressed
+	int nonzeros;
+	// uint8 [class]: staged values
+	int stage_count;
+	// [class][value lane | count lane]
+	int lanes;
+	// uint64 [class][max_bin_size + 2]: cumulative bin counts, filled by
+	// build_prefix_arrays once a leaf is compressed; get_total_array and
+	// sum_array read them.
+	int prefix;
+	// float [class][HISTOGRAM_STAGE_SIZE]
+	int stage;
+	// size, nonzeros and stage_count are the first `header` bytes, which are
+	// cleared when the block is handed out; no bin is read past the sizes
+	int header;
+	long long bytes;
+};
+
+extern HistogramLayout histogram_layout;
+// entries per lane: max_bin_size + 1 rounded up to HISTOGRAM_ALIGN
+extern int histogram_lane;
+
+/* the histograms of one leaf, histogram_leaves[histogram_id] */
+struct LeafHistograms {
+	// the table: feature id (-1 for a free entry) and its block, a power of
+	// two of entries at most half full, probed linearly from feature_hash
+	std::vector<int32_t> keys;
+	std::vector<char*> blocks;
+	int shift;
+	// the features in the table; ascending once finish_sparse ran
+	std::vector<int> features;
+	// the arena chunks the blocks are carved from, and the rest of the last one
+	std::vector<char*> chunks;
+	char *next, *end;
+};
+
+extern LeafHistograms* histogram_leaves;
+
+inline uint32_t feature_hash(int feature_id, int shift) {
+	return ((uint32_t) feature_id * 2654435761u) >> shift;
+}
+
+/* the block of a feature of a leaf, or NULL if the leaf has not seen it */
+inline char *find_feature_block(int histogram_id, int feature_id) {
+	const LeafHistograms &leaf = histogram_leaves[histogram_id];
+	const int32_t *keys = leaf.keys.data();
+	uint32_t mask = leaf.keys.size() - 1;
+	for (uint32_t i = feature_hash(feature_id, leaf.shift); ; i = (i + 1) & mask) {
+		if (keys[i] == feature_id) return leaf.blocks[i];
+		if (keys[i] < 0) return NULL;
+	}
+}
+
+/* add an empty block for a feature the leaf has not seen */
+char *add_feature_block(int histogram_id, int feature_id);
+
+inline char *feature_block(int histogram_id, int feature_id) {
+	char *block = find_feature_block(histogram_id, feature_id);
+	return block ? block : add_feature_block(histogram_id, feature_id);
+}
+
+inline int32_t *block_nonzeros(char *block) {
+	return (int32_t*) (block + histogram_layout.nonzeros);
+}
+
+inline uint8_t *block_stage_count(char *block) {
+	return (uint8_t*) (block + histogram_layout.stage_count);
+}
+
+inline float *block_stage(char *block, int label) {
+	return (float*) (block + histogram_layout.stage) + label * HISTOGRAM_STAGE_SIZE;
+}
+
+// shrink_array does up to this many merges with merge_bin_array scans
+#define SHRINK_SCAN_MERGES 4
+
+/* the bins of one histogram: views into its lanes and its size */
+struct BinArray {
+	int32_t *size;
+	float *value;
+	uint32_t *freq;
+};
+
+inline int get_bin_size(BinArray histo) {
+	return *histo.size;
+}
+
+inline void set_bin_size(BinArray histo, int size) {
+	*histo.size = size;
+}
+
+inline float get_bin_value(BinArray histo, int index) {
+	return histo.value[index];
+}
+
+inline uint32_t get_bin_freq(BinArray histo, int index) {
+	return histo.freq[index];
+}
+
+inline void set_bin_value(BinArray histo, int index, float value) {
+	histo.value[index] = value;
+}
+
+inline void set_bin_freq(BinArray histo, int index, uint32_t freq) {
+	histo.freq[index] = freq;
+}
+
+inline BinArray make_bin_array(int32_t *size, float *value, uint32_t *freq) {
+	BinArray histo = {size, value, freq};
+	return histo;
+}
+
+/* a BinArray with storage of its own, for intermediate results */
+class BinBuffer {
+public:
+	BinBuffer() : size(0) {}
+	BinBuffer(int capacity) : size(0), values(capacity), counts(capacity) {}
+	/* the bins, with room for at least `capacity` of them */
+	BinArray bins(int capacity) {
+		if ((int) values.size() < capacity) {
+			values.resize(capacity);
+			counts.resize(capacity);
+		}
+		return bins();
+	}
+	BinArray bins() {
+		return make_bin_array(&size, values.data(), counts.data());
+	}
+private:
+	int32_t size;
+	std::vector<float> values;
+	std::vector<uint32_t> counts;
+};
 
 /*
- * For A[][M][N][Z]
- * A[i][j][k][e] = A[N*Z*M*i+Z*N*j+k*Z+e]
+ * Sizes computed from num_of_features, num_of_classes and max_bin_size are
+ * 64-bit, and alloc_histograms exits on one that would overflow rather than
+ * alias memory.
+ *
+ * The histogram pool. A leaf carves its feature blocks from arena chunks of
+ * about HISTOGRAM_ARENA_CHUNK bytes, taken as it needs them, and gives the
+ * chunks back once it is labeled or split. A chunk is not cleared when it is
+ * given back, only the header of each block carved from it again.
  */
-int RLOC(int i, int j, int k, int e, int M, int N, int Z);
+#define HISTOGRAM_ARENA_CHUNK (64LL << 10)
+// entries of an empty leaf table
+#define HISTOGRAM_TABLE_MIN 16
+
+struct HistogramPoolStats {
+	// bytes of one feature block
+	long long block_bytes;
+	// bytes of the arena chunks
+	long long arena_bytes;
+	// bytes of the chunks held by leaves now, and at most so far
+	long long in_use_bytes;
+	long long peak_bytes;
+	// bytes cleared since the pool was set up: leaf tables and block headers
+	long long zeroed_bytes;
+};
+
+extern HistogramPoolStats histogram_pool_stats;
+
+/* set up the pool for histogram_ids [0, max_leaves); returns the bytes of a feature block */
+long long alloc_histograms(int max_leaves);
+/* grow the pool to histogram_ids [0, max_leaves), keeping the current histograms */
+void reserve_histograms(int max_leaves);
+/* give leaves [0, num_leaves) an empty table each; returns the bytes cleared */
+long long acquire_histograms(int num_leaves);
+/* the same for leaf histogram_id alone; leaves of different threads may be acquired at once */
+long long acquire_histogram(int histogram_id);
+/* return the chunks of a leaf to the pool; a no-op for -1. Thread safe. */
+void release_histogram(int histogram_id);
+void free_histograms();
+
+/* a * b for sizing buffers; exits naming `what` if it overflows 64 bits */
+long long checked_mul(long long a, long long b, const char *what);
+
+/* entries per lane for up to `bins` + 1 bins, see histogram_lane */
+constexpr int lane_floats(int bins) {
+	return (bins + 1 + HISTOGRAM_ALIGN / 4 - 1) / (HISTOGRAM_ALIGN / 4) * (HISTOGRAM_ALIGN / 4);
+}
 
 /*
- * For A[][M][N][Z]
- * A[i][j][k] = A[N*Z*M*i+Z*N*j+k*Z]
+ * The histogram geometry, as compile-time constants where they are known.
+ * The histogram kernels are templates on the bin count BINS and the class
+ * count CLASSES, instantiated for the common sizes (16 ... 256 bins, two
+ * classes, see select_histogram_kernels). 0 stands for the runtime
+ * max_bin_size / num_of_classes of the generic kernels.
  */
-int RLOC(int i, int j, int k, int M, int N, int Z);
+template <int BINS, int CLASSES>
+struct HistogramShape {
+	static int bins() { return BINS ? BINS : max_bin_size; }
+	static int classes() { return CLASSES ? CLASSES : num_of_classes; }
+	static int lane() { return BINS ? lane_floats(BINS) : histogram_lane; }
+	/* histogram `label` of a feature block */
+	static BinArray histo(char *block, int label) {
+		float *value = (float*) (block + histogram_layout.lanes) + (long long) label * 2 * lane();
+		return make_bin_array((int32_t*) (block + histogram_layout.size) + label, value, (uint32_t*) (value + lane()));
+	}
+	static BinArray histo(int histogram_id, int feature_id, int label) {
+		return histo(feature_block(histogram_id, feature_id), label);
+	}
+	static uint64_t *prefix(int histogram_id, int feature_id, int label) {
+		char *block = feature_block(histogram_id, feature_id);
+		return (uint64_t*) (block + histogram_layout.prefix) + (long long) label * (bins() + 2);
+	}
+};
 
 /*
- * For A[][M][N][Z]
- * A[i][j] = A[N*Z*M*i+Z*N*j]
+ * The kernels for one histogram geometry. update_array, update_array_batch,
+ * merge_array_pointers, uniform_array and sum_array call the ones of
+ * histogram_kernels, which alloc_histograms selects for max_bin_size and
+ * num_of_classes; the generic ones work for any geometry.
  */
-int RLOC(int i, int j, int M, int N, int Z);
+struct HistogramKernels {
+	void (*update)(int histogram_id, int feature_id, int label, float value, uint32_t freq);
+	void (*update_batch)(int histogram_id, int feature_id, int label, float *values, int n);
+	void (*merge)(BinArray histo1, BinArray histo2);
+	void (*uniform)(std::vector<float> &u, int histogram_id, int feature_id, int label, BinArray histo);
+	float (*sum)(int histogram_id, int feature_id, int label, float value);
+};
+
+extern HistogramKernels histogram_kernels;
+/* the kernels specialized for `bins` and `classes`, or the generic ones (also for 0, 0) */
+HistogramKernels select_histogram_kernels(int bins, int classes);
+
+void print_array(BinArray histo);
+BinArray get_histogram_array(int histogram_id, int feature_id, int label);
+uint64_t *get_prefix_array(int histogram_id, int feature_id, int label);
+void prefix_array(BinArray histo, uint64_t *prefix);
+void build_prefix_arrays(int histogram_id);
+float sum_prefix(BinArray histo, const uint64_t *prefix, float value);
+float sum_prefix(BinArray histo, const uint64_t *prefix, float value, int &cursor);
+uint64_t get_total_array(int histogram_id, int feature_id, int label);
+float sum_array(int histogram_id, int feature_id, int label, float value);
+void copy_array(BinArray dst, BinArray src);
+void merge_array_pointers(BinArray histo1, BinArray histo2);
+void merge_arrays(BinArray out, const BinArray *in, int n);
+void merge_array(int histogram_id1, int feature_id1, int label1, int histogram_id2, int feature_id2, int label2);
+void uniform_array(std::vector<float> &u, int histogram_id, int feature_id, int label, BinArray histo);
+void update_array(int histogram_id, int feature_id, int label, float value);
+void update_array(int histogram_id, int feature_id, int label, float value, uint32_t freq);
+void update_array_batch(int histogram_id, int feature_id, int label, float *values, int n);
+void shrink_array(BinArray histo, int max_bins);
 
 /*
- * For A[][M][N][Z]
- * A[i] = A[N*Z*M*i]
+ * Wire format of the histograms of leaves [0, num_leaves), e.g. for MPI:
+ * per leaf the int32 number of its features, and per feature its int32 id
+ * and, for every class, the int32 bin count, then the values (float) and
+ * the counts (uint32) of the bins in use. unpack_histograms merges them
+ * into the local histograms with merge_array_pointers, or overwrites those;
+ * a feature the local leaf has not seen gets a block.
  */
-int RLOC(int i, int M, int N, int Z);
\ No newline at end of file
+void pack_histograms(int num_leaves, std::vector<char> &buffer);
+void unpack_histograms(int num_leaves, const char *buffer, bool merge);
+/*
+ * Merge n packed buffers into the local histograms at once, with one
+ * merge_arrays per histogram. Their leaves must have the same features in
+ * the same order as the local ones, e.g. after the features were shared and
+ * finish_sparse sorted them.
+ */
+void merge_packed_histograms(int num_leaves, const char **buffers, int n);
+void prelay_array(BinArray histo, const float *values, int num_bins);
+void compact_array(BinArray histo);
+
+/* count `freq` more values into bin `index` of a histogram laid out by prelay_array */
+inline void add_bin_freq(BinArray histo, int index, uint32_t freq = 1) {
+	histo.freq[index] += freq;
+}
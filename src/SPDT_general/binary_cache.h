@@ -0,0 +1,253 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mmap_reader.h"
+
+/*
+ * Binary dataset cache.
+ *
+ * The first parse of "<name>" writes "<name>.bin"; later runs map that file
+ * and use it in place instead of parsing the text again.
+ * Layout (native byte order, every section starts on an 8-byte boundary):
+ *
+ *   BinaryHeader
+ *   int32   labels[num_rows]
+ *   int64   row_offset[num_rows + 1]
+ *   int32   feature_index[num_values]   (0-based, sorted within a row)
+ *   float   feature_value[num_values]
+ */
+
+#define BINARY_CACHE_MAGIC "SPDTBIN"
+#define BINARY_CACHE_VERSION 1
+
+struct BinaryHeader {
+	char magic[8];
+	int32_t version;
+	int32_t num_of_classes;  // labels depend on it, see RowStore::read_a_data
+	int64_t num_rows;
+	int64_t num_values;
+	int64_t num_pos_label;
+	int64_t source_size;     // size and mtime of the text file it was made from
+	int64_t source_mtime;
+	int32_t max_feature;     // largest feature id + 1
+	int32_t reserved;
+};
+
+inline int64_t align8(int64_t n) {
+	return (n + 7) & ~(int64_t) 7;
+}
+
+inline std::string binary_cache_name(const std::string& name) {
+	return name + ".bin";
+}
+
+/* size and mtime of a file, false if it does not exist */
+inline bool file_signature(const std::string& name, int64_t& size, int64_t& mtime) {
+	struct stat st;
+	if (stat(name.c_str(), &st) != 0) return false;
+	size = st.st_size;
+	mtime = st.st_mtime;
+	return true;
+}
+
+/*
+ * A mapped cache file. The section pointers stay valid until close().
+ */
+class BinaryCache {
+public:
+	const BinaryHeader* header;
+	const int* labels;
+	const long long* row_offset;
+	const int* feature_index;
+	const float* feature_value;
+
+	BinaryCache() { reset(); }
+
+	/*
+	 * Map the cache of the text file `source`.
+	 * Return false if there is none or it is stale, from another version
+	 * or made with another number of classes.
+	 */
+	bool open(const std::string& source, int num_of_classes) {
+		close();
+		if (!file.open(binary_cache_name(source))) return false;
+		if (file.size < sizeof(BinaryHeader)) {
+			close();
+			return false;
+		}
+		header = (const BinaryHeader*) file.begin;
+		int64_t size, mtime;
+		bool ok = memcmp(header->magic, BINARY_CACHE_MAGIC, 8) == 0
+			&& header->version == BINARY_CACHE_VERSION
+			&& header->num_of_classes == num_of_classes;
+		// a cache without its text file is still usable
+		if (ok && file_signature(source, size, mtime))
+			ok = (size == header->source_size && mtime == header->source_mtime);
+		int64_t off = align8(sizeof(BinaryHeader));
+		int64_t off_offset = align8(off + header->num_rows * sizeof(int));
+		int64_t off_index = align8(off_offset + (header->num_rows + 1) * sizeof(long long));
+		int64_t off_value = align8(off_index + header->num_values * sizeof(int));
+		int64_t total = off_value + header->num_values * sizeof(float);
+		if (!ok || (int64_t) file.size < total) {
+			close();
+			return false;
+		}
+		labels = (const int*) (file.begin + off);
+		row_offset = (const long long*) (file.begin + off_offset);
+		feature_index = (const int*) (file.begin + off_index);
+		feature_value = (const float*) (file.begin + off_value);
+		return true;
+	}
+
+	void close() {
+		file.close();
+		reset();
+	}
+
+	bool is_open() const { return header != NULL; }
+
+	long long num_rows() const { return header->num_rows; }
+	int max_feature() const { return header->max_feature; }
+
+private:
+	MappedFile file;
+
+	void reset() {
+		header = NULL;
+		labels = NULL;
+		row_offset = NULL;
+		feature_index = NULL;
+		feature_value = NULL;
+	}
+};
+
+/*
+ * Write a cache while a text file is parsed batch by batch.
+ * Sections are spooled into anonymous temporary files and concatenated by
+ * finish(), which publishes the cache with an atomic rename, so concurrent
+ * writers (e.g. MPI ranks) never expose a half-written file.
+ */
+class BinaryCacheWriter {
+public:
+	BinaryCacheWriter() : num_rows(0), num_values(0), num_pos_label(0), max_feature(0) {
+		for (int k = 0; k < 4; k++) section[k] = NULL;
+	}
+	~BinaryCacheWriter() { discard(); }
+
+	bool open(const std::string& _source, int _num_of_classes) {
+		discard();
+		source = _source;
+		num_of_classes = _num_of_classes;
+		num_rows = num_values = num_pos_label = 0;
+		max_feature = 0;
+		for (int k = 0; k < 4; k++) {
+			section[k] = tmpfile();
+			if (section[k] == NULL) {
+				discard();
+				return false;
+			}
+		}
+		long long zero = 0;
+		fwrite(&zero, sizeof(long long), 1, section[1]);
+		return true;
+	}
+
+	bool is_open() const { return section[0] != NULL; }
+
+	/*
+	 * Append `n` rows. row_offset has n + 1 entries and may start anywhere;
+	 * index and value are addressed with it.
+	 */
+	void append(int n, const int* labels, const long long* row_offset,
+		const int* index, const float* value, int pos_label) {
+		if (!is_open()) return;
+		long long begin = row_offset[0];
+		long long count = row_offset[n] - begin;
+		fwrite(labels, sizeof(int), n, section[0]);
+		for (int i = 1; i <= n; i++) {
+			long long off = num_values + row_offset[i] - begin;
+			fwrite(&off, sizeof(long long), 1, section[1]);
+		}
+		fwrite(index + begin, sizeof(int), count, section[2]);
+		fwrite(value + begin, sizeof(float), count, section[3]);
+		for (long long k = begin; k < row_offset[n]; k++)
+			if (index[k] + 1 > max_feature) max_feature = index[k] + 1;
+		for (int i = 0; i < n; i++)
+			if (labels[i] == pos_label) num_pos_label++;
+		num_rows += n;
+		num_values += count;
+	}
+
+	/* write "<source>.bin", return false on any I/O error */
+	bool finish() {
+		if (!is_open()) return false;
+		BinaryHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, BINARY_CACHE_MAGIC, 8);
+		header.version = BINARY_CACHE_VERSION;
+		header.num_of_classes = num_of_classes;
+		header.num_rows = num_rows;
+		header.num_values = num_values;
+		header.num_pos_label = num_pos_label;
+		header.max_feature = max_feature;
+		file_signature(source, header.source_size, header.source_mtime);
+
+		std::string name = binary_cache_name(source);
+		std::string tmp = name + ".tmp." + std::to_string((long long) getpid());
+		FILE* out = fopen(tmp.c_str(), "wb");
+		bool ok = (out != NULL);
+		if (ok) {
+			ok = fwrite(&header, sizeof(header), 1, out) == 1;
+			for (int k = 0; k < 4 && ok; k++) {
+				ok = pad8(out) && copy_section(section[k], out);
+			}
+			ok = (fclose(out) == 0) && ok;
+			if (ok) ok = (rename(tmp.c_str(), name.c_str()) == 0);
+			if (!ok) remove(tmp.c_str());
+		}
+		discard();
+		return ok;
+	}
+
+	void discard() {
+		for (int k = 0; k < 4; k++) {
+			if (section[k] != NULL) fclose(section[k]);
+			section[k] = NULL;
+		}
+	}
+
+private:
+	// labels, row_offset, feature_index, feature_value
+	FILE* section[4];
+	std::string source;
+	int num_of_classes;
+	long long num_rows;
+	long long num_values;
+	long long num_pos_label;
+	int max_feature;
+
+	static bool pad8(FILE* out) {
+		static const char zeros[8] = {0};
+		long pos = ftell(out);
+		if (pos < 0) return false;
+		size_t pad = align8(pos) - pos;
+		return fwrite(zeros, 1, pad, out) == pad;
+	}
+
+	static bool copy_section(FILE* in, FILE* out) {
+		char buf[1 << 16];
+		if (fflush(in) != 0 || fseek(in, 0, SEEK_SET) != 0) return false;
+		size_t n;
+		while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+			if (fwrite(buf, 1, n, out) != n) return false;
+		}
+		return !ferror(in);
+	}
+
+	BinaryCacheWriter(const BinaryCacheWriter&);
+	BinaryCacheWriter& operator = (const BinaryCacheWriter&);
+};
@@ -0,0 +1,201 @@
+#include <float.h>
+#include <string.h>
+#include "binning.h"
+
+bool use_binning = false;
+FeatureBins feature_bins;
+
+/*
+ * Compute the cut points of every feature from the rows in `data`
+ * (at most BINNING_SAMPLE_ROWS of them, evenly strided).
+ */
+void FeatureBins::build(vector<Data>& data, int max_bins_per_feature) {
+	first_bin.clear();
+	bin_value.clear();
+	bin_upper.clear();
+	zero_bin.clear();
+	max_bins = 0;
+	if (data.empty() || max_bins_per_feature <= 0) return;
+	max_bins = max_bins_per_feature;
+
+	int stride = (data.size() + BINNING_SAMPLE_ROWS - 1) / BINNING_SAMPLE_ROWS;
+	vector<vector<float> > values(num_of_features);
+	int sampled = 0;
+	for (int i = 0; i < (int) data.size(); i += stride) {
+		Data& d = data[i];
+		for (int k = 0; k < d.num_values; k++) {
+			if (d.index[k] < num_of_features) values[d.index[k]].push_back(d.value[k]);
+		}
+		sampled++;
+	}
+
+	first_bin.push_back(0);
+	for (int f = 0; f < num_of_features; f++) {
+		add_feature(values[f], sampled - values[f].size());
+		vector<float>().swap(values[f]);
+		first_bin.push_back(bin_value.size());
+		zero_bin.push_back(bin_of(f, 0));
+	}
+}
+
+/*
+ * Append the bins of one feature, given its sampled nonzero values and the
+ * number of sampled zeros.
+ * Distinct values are grouped greedily into bins of about equal mass; a value
+ * heavier than a bin's share (typically 0) stays alone. If there are no more
+ * distinct values left than bins, each of them gets its own bin.
+ */
+void FeatureBins::add_feature(vector<float>& values, int zeros) {
+	sort(values.begin(), values.end());
+	vector<float> distinct;
+	vector<int> count;
+	bool zero_done = (zeros == 0);
+	int n = values.size();
+	for (int i = 0; i <= n; i++) {
+		if (!zero_done && (i == n || values[i] > 0)) {
+			if (!distinct.empty() && distinct.back() == 0) {
+				count.back() += zeros;
+			} else {
+				distinct.push_back(0);
+				count.push_back(zeros);
+			}
+			zero_done = true;
+		}
+		if (i == n) break;
+		if (!distinct.empty() && distinct.back() == values[i]) {
+			count.back()++;
+		} else {
+			distinct.push_back(values[i]);
+			count.push_back(1);
+		}
+	}
+	if (distinct.empty()) {
+		// never seen at all
+		distinct.push_back(0);
+		count.push_back(1);
+	}
+
+	int d = distinct.size();
+	long long left_mass = 0;
+	for (int i = 0; i < d; i++) left_mass += count[i];
+	int bins = 0;
+	int i = 0;
+	while (i < d) {
+		int left_bins = max_bins - bins;
+		int start = i;
+		long long mass = 0;
+		if (d - i <= left_bins) {
+			mass = count[i++];
+		} else if (left_bins == 1) {
+			while (i < d) mass += count[i++];
+		} else {
+			double share = (double) left_mass / left_bins;
+			do {
+				mass += count[i++];
+			} while (i < d && mass + count[i] <= share);
+		}
+		double sum = 0;
+		for (int j = start; j < i; j++) sum += (double) distinct[j] * count[j];
+		bin_value.push_back(start + 1 == i ? distinct[start] : (float) (sum / mass));
+		bin_upper.push_back(i < d ? (distinct[i - 1] + distinct[i]) / 2 : FLT_MAX);
+		left_mass -= mass;
+		bins++;
+	}
+}
+
+/* bin of `value` in feature `feature_id`, relative to first_bin[feature_id] */
+int FeatureBins::bin_of(int feature_id, float value) const {
+	const float* begin = bin_upper.data() + first_bin[feature_id];
+	const float* end = begin + num_bins(feature_id) - 1;
+	return upper_bound(begin, end, value) - begin;
+}
+
+/*
+ * Replace the values of the current batch of `d` by their bin indices.
+ * The indices live in d.bin8 / d.bin16 and every row view points into them.
+ */
+void FeatureBins::quantize(Dataset& d) const {
+	int n = d.dataset.size();
+	vector<long long> offset(n + 1, 0);
+	for (int i = 0; i < n; i++) offset[i + 1] = offset[i] + d.dataset[i].num_values;
+	bool narrow = (max_bins <= 256);
+	d.bin8.resize(narrow ? offset[n] : 0);
+	d.bin16.resize(narrow ? 0 : offset[n]);
+
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < n; i++) {
+		Data& row = d.dataset[i];
+		for (int k = 0; k < row.num_values; k++) {
+			int f = row.index[k];
+			int bin = (f < num_of_features) ? bin_of(f, row.value[k]) : 0;
+			if (narrow) d.bin8[offset[i] + k] = bin;
+			else d.bin16[offset[i] + k] = bin;
+		}
+		row.bin8 = narrow ? d.bin8.data() + offset[i] : NULL;
+		row.bin16 = narrow ? NULL : d.bin16.data() + offset[i];
+	}
+}
+
+template <class T>
+static void pack_vector(char*& out, const vector<T>& v) {
+	memcpy(out, v.data(), v.size() * sizeof(T));
+	out += v.size() * sizeof(T);
+}
+
+template <class T>
+static void unpack_vector(const char*& in, vector<T>& v, int n) {
+	v.resize(n);
+	memcpy(v.data(), in, n * sizeof(T));
+	in += n * sizeof(T);
+}
+
+void FeatureBins::pack(vector<char>& buffer) const {
+	int32_t header[2] = {max_bins, (int32_t) zero_bin.size()};
+	buffer.resize(sizeof(header) + first_bin.size() * sizeof(int) + bin_value.size() * sizeof(float)
+		+ bin_upper.size() * sizeof(float) + zero_bin.size() * sizeof(int));
+	char* out = buffer.data();
+	memcpy(out, header, sizeof(header));
+	out += sizeof(header);
+	pack_vector(out, first_bin);
+	pack_vector(out, bin_value);
+	pack_vector(out, bin_upper);
+	pack_vector(out, zero_bin);
+}
+
+void FeatureBins::unpack(const vector<char>& buffer) {
+	int32_t header[2];
+	const char* in = buffer.data();
+	memcpy(header, in, sizeof(header));
+	in += sizeof(header);
+	max_bins = header[0];
+	int features = header[1];
+	if (max_bins <= 0) {
+		// the sender had no rows to build from
+		first_bin.clear();
+		bin_value.clear();
+		bin_upper.clear();
+		zero_bin.clear();
+		return;
+	}
+	unpack_vector(in, first_bin, features + 1);
+	unpack_vector(in, bin_value, first_bin[features]);
+	unpack_vector(in, bin_upper, first_bin[features]);
+	unpack_vector(in, zero_bin, features);
+}
+
+/* lay out the bins of a feature in its (empty) histograms of a leaf */
+void prelay_bins(int histogram_id, int feature_id) {
+	for (int c = 0; c < num_of_classes; c++) {
+		prelay_array(get_histogram_array(histogram_id, feature_id, c),
+			feature_bins.bin_value.data() + feature_bins.first_bin[feature_id], feature_bins.num_bins(feature_id));
+	}
+}
+
+/* remove the bins compress left empty from the histograms of a leaf */
+void drop_empty_bins(int histogram_id) {
+	for (int f : histogram_leaves[histogram_id].features) {
+		for (int c = 0; c < num_of_classes; c++) {
+			compact_array(get_histogram_array(histogram_id, f, c));
+		}
+	}
+}
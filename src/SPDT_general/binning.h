@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "tree.h"
+
+/*
+ * Pre-quantized features, the histogram design of LightGBM / XGBoost-hist.
+ *
+ * Cut points are computed once per feature from (a sample of) the first
+ * batch. Every stored value of a batch is then replaced by a small bin index
+ * (uint8 for up to 256 bins per feature, uint16 above), and compress only
+ * counts bin indices into histograms whose bins are laid out in advance by
+ * prelay_bins() as a leaf first sees a feature. A feature with at most
+ * max_bin_size distinct values gets one bin per value, which gives the same
+ * histograms as update_array.
+ */
+
+// set with -q: train on pre-quantized features
+extern bool use_binning;
+
+// rows of the first batch the cut points are computed from
+#define BINNING_SAMPLE_ROWS 200000
+
+class FeatureBins {
+public:
+	// bins of feature f are [first_bin[f], first_bin[f + 1])
+	vector<int> first_bin;
+	// representative value of a bin: the mean of the sampled values in it
+	vector<float> bin_value;
+	// a value belongs to the first bin of its feature with value < bin_upper
+	vector<float> bin_upper;
+	// bin of value 0 (i.e. of an absent feature), relative to first_bin[f]
+	vector<int> zero_bin;
+
+	FeatureBins() : max_bins(0) {}
+
+	bool ready() const { return max_bins > 0; }
+	int num_bins(int feature_id) const {
+		return first_bin[feature_id + 1] - first_bin[feature_id];
+	}
+
+	void build(vector<Data>& data, int max_bins_per_feature);
+	int bin_of(int feature_id, float value) const;
+	void quantize(Dataset& d) const;
+	/*
+	 * Wire format of the cut points, e.g. for MPI: the int32 max_bins and
+	 * number of features, then first_bin, bin_value, bin_upper and zero_bin.
+	 */
+	void pack(vector<char>& buffer) const;
+	void unpack(const vector<char>& buffer);
+
+private:
+	int max_bins;
+	void add_feature(vector<float>& values, int zeros);
+};
+
+extern FeatureBins feature_bins;
+
+void prelay_bins(int histogram_id, int feature_id);
+void drop_empty_bins(int histogram_id);
@@ -0,0 +1,61 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/*
+ * Blocking FIFO queue with a fixed capacity, used to hand items between a
+ * producer thread and a consumer thread.
+ * push() waits while the queue is full and pop() waits while it is empty.
+ * After close() both return false instead of waiting (pop() still drains
+ * what is left), which lets either side stop the other.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+	explicit BoundedQueue(size_t _capacity) : capacity(_capacity), closed(false) {}
+
+	bool push(const T& item) {
+		std::unique_lock<std::mutex> guard(lock);
+		not_full.wait(guard, [this] { return closed || items.size() < capacity; });
+		if (closed) return false;
+		items.push_back(item);
+		not_empty.notify_one();
+		return true;
+	}
+
+	bool pop(T& item) {
+		std::unique_lock<std::mutex> guard(lock);
+		not_empty.wait(guard, [this] { return closed || !items.empty(); });
+		if (items.empty()) return false;
+		item = items.front();
+		items.pop_front();
+		not_full.notify_one();
+		return true;
+	}
+
+	void close() {
+		std::lock_guard<std::mutex> guard(lock);
+		closed = true;
+		not_empty.notify_all();
+		not_full.notify_all();
+	}
+
+	/* empty the queue and accept items again */
+	void reopen() {
+		std::lock_guard<std::mutex> guard(lock);
+		items.clear();
+		closed = false;
+	}
+
+private:
+	size_t capacity;
+	bool closed;
+	std::deque<T> items;
+	std::mutex lock;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+
+	BoundedQueue(const BoundedQueue&);
+	BoundedQueue& operator = (const BoundedQueue&);
+};
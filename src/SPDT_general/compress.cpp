@@ -0,0 +1,90 @@
+#include "compress.h"
+
+vector<int> leaf_rows;
+
+void reset_sparse(int num_leaves) {
+	leaf_rows.assign(num_leaves * num_of_classes, 0);
+}
+
+/* fold in the staged values of a leaf */
+void flush_sparse(int histogram_id) {
+	if (feature_bins.ready()) return;
+	for (int attr : histogram_leaves[histogram_id].features) {
+		char *block = find_feature_block(histogram_id, attr);
+		uint8_t *stage_count = block_stage_count(block);
+		for (int c = 0; c < num_of_classes; c++) {
+			if (stage_count[c] == 0) continue;
+			update_array_batch(histogram_id, attr, c, block_stage(block, c), stage_count[c]);
+			stage_count[c] = 0;
+		}
+	}
+}
+
+/* give leaf `dst` the rows and the features of leaves src[0, n) */
+void gather_sparse(int dst, const int *src, int n) {
+	for (int i = 0; i < n; i++) {
+		for (int c = 0; c < num_of_classes; c++)
+			leaf_rows[dst * num_of_classes + c] += leaf_rows[src[i] * num_of_classes + c];
+		for (int attr : histogram_leaves[src[i]].features)
+			sparse_block(dst, attr);
+	}
+}
+
+/*
+ * Add the histograms and stored value counts of feature `attr` of leaves
+ * src[0, n) to leaf `dst`, after gather_sparse; all of them are flushed and
+ * have no zeros yet. The histograms are merged in one pass with merge_arrays.
+ * Binned histograms have the same bins laid out and are added bin by bin.
+ */
+void merge_sparse(int dst, const int *src, int n, int attr) {
+	bool binned = feature_bins.ready();
+	char *to = find_feature_block(dst, attr);
+	static thread_local vector<BinArray> in;
+	in.resize(n + 1);
+	for (int c = 0; c < num_of_classes; c++) {
+		BinArray out = HistogramShape<0, 0>::histo(to, c);
+		int k = 0;
+		in[k++] = out;
+		for (int i = 0; i < n; i++) {
+			char *from = find_feature_block(src[i], attr);
+			if (from == NULL) continue;
+			block_nonzeros(to)[c] += block_nonzeros(from)[c];
+			in[k++] = HistogramShape<0, 0>::histo(from, c);
+		}
+		if (binned) {
+			for (int j = 1; j < k; j++)
+				for (int b = 0; b < get_bin_size(in[j]); b++)
+					add_bin_freq(out, b, get_bin_freq(in[j], b));
+		} else {
+			merge_arrays(out, in.data(), k);
+		}
+	}
+}
+
+/*
+ * Fold in the staged values and add the implicit zeros of a leaf;
+ * drop the bins nothing fell into and cache the cumulative frequencies.
+ */
+void finish_sparse(int histogram_id) {
+	vector<int> &features = histogram_leaves[histogram_id].features;
+	const int* rows = leaf_rows.data() + histogram_id * num_of_classes;
+	bool binned = feature_bins.ready();
+	// split finding visits the features in this order
+	sort(features.begin(), features.end());
+	flush_sparse(histogram_id);
+	for (int attr : features) {
+		char *block = find_feature_block(histogram_id, attr);
+		const int32_t *nonzeros = block_nonzeros(block);
+		for (int c = 0; c < num_of_classes; c++) {
+			int zeros = rows[c] - nonzeros[c];
+			if (zeros <= 0) continue;
+			if (binned)
+				add_bin_freq(HistogramShape<0, 0>::histo(block, c), feature_bins.zero_bin[attr], zeros);
+			else
+				update_array(histogram_id, attr, c, 0.f, zeros);
+		}
+	}
+	if (binned)
+		drop_empty_bins(histogram_id);
+	build_prefix_arrays(histogram_id);
+}
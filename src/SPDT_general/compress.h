@@ -0,0 +1,74 @@
+#pragma once
+#include <vector>
+#include "tree.h"
+#include "binning.h"
+
+/*
+ * Sparsity-aware compress kernel shared by the trainers.
+ *
+ * A row only inserts its stored values, and a leaf only gets the histograms
+ * of the features it sees (see LeafHistograms). The zeros a leaf did not see
+ * are added by finish_sparse() with one weighted insert per (feature, class)
+ * of its features: the rows of the class in the leaf minus the stored values
+ * counted for it. sum_array and uniform_array then see the zero mass as an
+ * ordinary bin.
+ *
+ * Raw values are not inserted one by one either: each histogram stages up to
+ * HISTOGRAM_STAGE_SIZE of them and folds them in with update_array_batch
+ * when the stage is full and in finish_sparse(), i.e. before split finding.
+ * The bins then come from one merge per stage instead of one per value, so
+ * they are close to, but not the same as, those of sequential update_array.
+ * The stage and the count of stored values are kept in the feature block.
+ *
+ * Usage: reset_sparse(num_leaves), update_sparse() for every row,
+ * finish_sparse() once per leaf, which also builds its prefix arrays.
+ * Different leaves may be compressed by different threads. The rows of one
+ * leaf may also be spread over several histogram_ids, which are then
+ * flush_sparse()d and combined with gather_sparse() and merge_sparse()
+ * (per feature) before finish_sparse().
+ */
+
+// rows per [histogram_id][class]
+extern vector<int> leaf_rows;
+
+void reset_sparse(int num_leaves);
+void flush_sparse(int histogram_id);
+void gather_sparse(int dst, const int *src, int n);
+void merge_sparse(int dst, const int *src, int n, int attr);
+void finish_sparse(int histogram_id);
+
+/* the block of a feature of a leaf; a new one is laid out for the feature's bins */
+inline char *sparse_block(int histogram_id, int attr) {
+	char *block = find_feature_block(histogram_id, attr);
+	if (block == NULL) {
+		block = add_feature_block(histogram_id, attr);
+		if (feature_bins.ready())
+			prelay_bins(histogram_id, attr);
+	}
+	return block;
+}
+
+inline void stage_value(char *block, int histogram_id, int attr, int label, float value) {
+	uint8_t &count = block_stage_count(block)[label];
+	float* stage = block_stage(block, label);
+	stage[count++] = value;
+	if (count == HISTOGRAM_STAGE_SIZE) {
+		update_array_batch(histogram_id, attr, label, stage, HISTOGRAM_STAGE_SIZE);
+		count = 0;
+	}
+}
+
+inline void update_sparse(int histogram_id, Data& point) {
+	bool binned = feature_bins.ready();
+	leaf_rows[histogram_id * num_of_classes + point.label]++;
+	for (int k = 0; k < point.num_values; k++) {
+		int attr = point.index[k];
+		if (attr >= num_of_features) break;
+		char *block = sparse_block(histogram_id, attr);
+		block_nonzeros(block)[point.label]++;
+		if (binned)
+			add_bin_freq(HistogramShape<0, 0>::histo(block, point.label), point.bin_at(k));
+		else
+			stage_value(block, histogram_id, attr, point.label, point.value[k]);
+	}
+}
@@ -0,0 +1,121 @@
+#include <algorithm>
+#include "feature_map.h"
+
+bool use_feature_map = false;
+
+/* forget all ids; raw ids are those below `raw_features` */
+void FeatureMap::reset(int raw_features) {
+	raw_id.clear();
+	dense_id.assign(raw_features, -1);
+	frozen = false;
+}
+
+/* used[f] is set for every raw id f the rows store a value of */
+void FeatureMap::mark_used(const vector<Data>& data, vector<char>& used) const {
+	int raw_features = dense_id.size();
+	used.assign(raw_features, 0);
+	for (const Data& d : data) {
+		for (int k = 0; k < d.num_values; k++) {
+			if (d.index[k] >= raw_features) break;
+			used[d.index[k]] = 1;
+		}
+	}
+}
+
+/* give the used raw ids without one the next dense ids, return how many */
+int FeatureMap::extend(const vector<char>& used) {
+	if (frozen) return 0;
+	int added = 0;
+	for (int f = 0; f < (int) used.size(); f++) {
+		if (!used[f] || dense_id[f] >= 0) continue;
+		dense_id[f] = raw_id.size();
+		raw_id.push_back(f);
+		added++;
+	}
+	return added;
+}
+
+/*
+ * Rewrite the feature ids of the current batch of `d` to dense ids, dropping
+ * the values of unmapped features. The rows are copied into the batch's own
+ * CSR arrays, because they may point into the read-only binary cache. A row
+ * is sorted again only if ids added by later batches broke its order.
+ */
+void FeatureMap::remap(Dataset& d) const {
+	int raw_features = dense_id.size();
+	int n = d.dataset.size();
+	long long total = 0;
+	for (int i = 0; i < n; i++) total += d.dataset[i].num_values;
+	vector<long long> row_offset(n + 1, 0);
+	vector<int> index;
+	vector<float> value;
+	index.reserve(total);
+	value.reserve(total);
+	vector<pair<int, float> > row;
+	for (int i = 0; i < n; i++) {
+		Data& data = d.dataset[i];
+		bool sorted = true;
+		for (int k = 0; k < data.num_values; k++) {
+			int f = data.index[k];
+			if (f >= raw_features) break;
+			f = dense_id[f];
+			if (f < 0) continue;
+			if ((long long) index.size() > row_offset[i] && index.back() > f) sorted = false;
+			index.push_back(f);
+			value.push_back(data.value[k]);
+		}
+		row_offset[i + 1] = index.size();
+		if (!sorted) {
+			row.clear();
+			for (long long k = row_offset[i]; k < row_offset[i + 1]; k++)
+				row.push_back(make_pair(index[k], value[k]));
+			sort(row.begin(), row.end());
+			for (int k = 0; k < (int) row.size(); k++) {
+				index[row_offset[i] + k] = row[k].first;
+				value[row_offset[i] + k] = row[k].second;
+			}
+		}
+	}
+	d.rows.row_offset.swap(row_offset);
+	d.rows.feature_index.swap(index);
+	d.rows.feature_value.swap(value);
+	for (int i = 0; i < n; i++) {
+		Data& data = d.dataset[i];
+		data.num_values = d.rows.row_offset[i + 1] - d.rows.row_offset[i];
+		data.index = d.rows.feature_index.data() + d.rows.row_offset[i];
+		data.value = d.rows.feature_value.data() + d.rows.row_offset[i];
+		data.bin8 = NULL;
+		data.bin16 = NULL;
+	}
+}
+
+/*
+ * Give the rows of the current batch of `d`, which remap() rewrote into the
+ * batch's own CSR arrays, their original feature ids back. The bins of the rows are dropped, they are laid
+ * out for the dense ids.
+ */
+void FeatureMap::restore(Dataset& d) const {
+	vector<int>& index = d.rows.feature_index;
+	vector<float>& value = d.rows.feature_value;
+	vector<pair<int, float> > row;
+	for (int i = 0; i < (int) d.dataset.size(); i++) {
+		long long begin = d.rows.row_offset[i], end = d.rows.row_offset[i + 1];
+		bool sorted = true;
+		for (long long k = begin; k < end; k++) {
+			index[k] = raw_id[index[k]];
+			if (k > begin && index[k - 1] > index[k]) sorted = false;
+		}
+		if (!sorted) {
+			row.clear();
+			for (long long k = begin; k < end; k++)
+				row.push_back(make_pair(index[k], value[k]));
+			sort(row.begin(), row.end());
+			for (long long k = begin; k < end; k++) {
+				index[k] = row[k - begin].first;
+				value[k] = row[k - begin].second;
+			}
+		}
+		d.dataset[i].bin8 = NULL;
+		d.dataset[i].bin16 = NULL;
+	}
+}
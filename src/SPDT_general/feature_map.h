@@ -0,0 +1,47 @@
+#pragma once
+#include <vector>
+#include "parser.h"
+
+/*
+ * Dense feature ids for sparse datasets.
+ *
+ * Raw feature ids run up to featureNum of the dataset, but a sparse training
+ * file (avazu-app, rcv1) only uses a fraction of them. A FeatureMap numbers
+ * the raw ids that occur in the training batches, in increasing raw order
+ * within each batch that brings new ones, and rewrites the rows to these
+ * dense ids; num_of_features then counts the used features only, so binning,
+ * the histogram pool and split finding work on the compact range. The first
+ * batch keeps the raw order, so the splits are searched in the same order and
+ * give the same tree.
+ *
+ * The tree splits on dense ids while it grows. Once training ends, train()
+ * maps the feature of every split back through raw_id and restores the rows
+ * still in memory, so the model and test() work on the original ids.
+ */
+
+// set with -r: train on dense feature ids
+extern bool use_feature_map;
+
+class FeatureMap {
+public:
+	// original id of every dense id
+	vector<int> raw_id;
+	// dense id of every raw id, -1 if it is not used
+	vector<int> dense_id;
+
+	FeatureMap() : frozen(false) {}
+
+	int size() const { return raw_id.size(); }
+	int raw_size() const { return dense_id.size(); }
+
+	void reset(int raw_features);
+	void mark_used(const vector<Data>& data, vector<char>& used) const;
+	int extend(const vector<char>& used);
+	void remap(Dataset& d) const;
+	void restore(Dataset& d) const;
+	// no new ids from now on, e.g. once the cut points of the features are fixed
+	void freeze() { frozen = true; }
+
+private:
+	bool frozen;
+};
@@ -0,0 +1,116 @@
+#include "gain.h"
+
+/* sweep_gains for a histogram geometry, see HistogramShape */
+template <int BINS, int CLASSES>
+double sweep_gains_kernel(TreeNode* node, int feature_id, const vector<float>& splits, vector<float>& gains) {
+    typedef HistogramShape<BINS, CLASSES> Shape;
+    int total_sum = node->data_size;
+    dbg_ensures(total_sum > 0);
+    int histogram_id = node->histogram_id;
+    BinArray histo_0 = Shape::histo(histogram_id, feature_id, NEG_LABEL);
+    BinArray histo_1 = Shape::histo(histogram_id, feature_id, POS_LABEL);
+    const uint64_t* prefix_0 = Shape::prefix(histogram_id, feature_id, NEG_LABEL);
+    const uint64_t* prefix_1 = Shape::prefix(histogram_id, feature_id, POS_LABEL);
+    // as get_total_array
+    double sum_class_0 = prefix_0[get_bin_size(histo_0)];
+    double sum_class_1 = prefix_1[get_bin_size(histo_1)];
+    dbg_assert((sum_class_1 - node->num_pos_label) < EPS);
+
+    double px_prior = sum_class_0 / (sum_class_0 + sum_class_1);
+    dbg_ensures(px_prior >= 0 && px_prior <= 1);
+    double entropy = ((1-px_prior) < EPS || px_prior < EPS) ? 0 : -px_prior * log2(px_prior) - (1-px_prior) * log2(1-px_prior);
+
+    // uniform_array gives fewer than BINS candidates, which then fit on the stack
+    float stack_0[BINS ? BINS : 1], stack_1[BINS ? BINS : 1];
+    int n = splits.size();
+    float* left_sum_class_0 = stack_0;
+    float* left_sum_class_1 = stack_1;
+    if (!BINS || n > BINS) {
+        SplitScratch& scratch = split_scratch();
+        scratch.left_0.resize(n);
+        scratch.left_1.resize(n);
+        left_sum_class_0 = scratch.left_0.data();
+        left_sum_class_1 = scratch.left_1.data();
+    }
+    int cursor_0 = 0, cursor_1 = 0;
+    for (int k = 0; k < n; k++) {
+        dbg_assert(k == 0 || splits[k - 1] <= splits[k]);
+        left_sum_class_0[k] = sum_prefix(histo_0, prefix_0, splits[k], cursor_0);
+        left_sum_class_1[k] = sum_prefix(histo_1, prefix_1, splits[k], cursor_1);
+    }
+    gains.resize(n);
+    compute_gains(n, total_sum, sum_class_0, sum_class_1, entropy, left_sum_class_0, left_sum_class_1, gains.data());
+    return entropy;
+}
+
+double sweep_gains(TreeNode* node, int feature_id, const vector<float>& splits, vector<float>& gains) {
+    // the bin counts select_histogram_kernels specializes
+    if (num_of_classes == 2) {
+        switch (max_bin_size) {
+        case 16: return sweep_gains_kernel<16, 2>(node, feature_id, splits, gains);
+        case 32: return sweep_gains_kernel<32, 2>(node, feature_id, splits, gains);
+        case 64: return sweep_gains_kernel<64, 2>(node, feature_id, splits, gains);
+        case 128: return sweep_gains_kernel<128, 2>(node, feature_id, splits, gains);
+        case 256: return sweep_gains_kernel<256, 2>(node, feature_id, splits, gains);
+        }
+    }
+    return sweep_gains_kernel<0, 0>(node, feature_id, splits, gains);
+}
+
+int argmax_gain(const vector<float>& gains) {
+    int best = -1;
+    for (int k = 0; k < (int) gains.size(); k++) {
+        if (best < 0 || gains[best] < gains[k])
+            best = k;
+    }
+    return best;
+}
+
+void best_of_splits(TreeNode* node, int feature_id, const vector<float>& splits, SplitPoint& best) {
+    vector<float>& gains = split_scratch().gains;
+    double entropy = sweep_gains(node, feature_id, splits, gains);
+    int k = argmax_gain(gains);
+    if (k >= 0 && best.gain < gains[k]) {
+        best = SplitPoint(feature_id, splits[k]);
+        best.gain = gains[k];
+        best.entropy = entropy;
+    }
+}
+
+void best_split_of_feature(TreeNode* node, int feature_id, SplitPoint& best) {
+    SplitScratch& scratch = split_scratch();
+    BinArray histo_for_class[2] = {get_histogram_array(node->histogram_id, feature_id, NEG_LABEL),
+                                   get_histogram_array(node->histogram_id, feature_id, POS_LABEL)};
+    BinArray merged = scratch.merged.bins(max_bin_size + 1);
+    merge_arrays(merged, histo_for_class, 2);
+    uniform_array(scratch.splits, node->histogram_id, feature_id, NEG_LABEL, merged);
+    dbg_assert(scratch.splits.size() <= max_bin_size);
+    best_of_splits(node, feature_id, scratch.splits, best);
+}
+
+void best_splits_of_leaves(const vector<TreeNode*>& leaves, vector<SplitPoint>& splits) {
+    int num_leaves = leaves.size();
+    // the (leaf, feature) pairs, leaf by leaf and in feature order
+    vector<pair<int, int> >& pairs = split_scratch().leaf_features;
+    pairs.clear();
+    for (int i = 0; i < num_leaves; i++) {
+        if (leaves[i] == NULL) continue;
+        for (int f : histogram_leaves[leaves[i]->histogram_id].features)
+            pairs.push_back(make_pair(i, f));
+    }
+    splits.assign(num_leaves, SplitPoint());
+    #pragma omp parallel
+    {
+        vector<SplitPoint>& best = split_scratch().leaf_best;
+        best.assign(num_leaves, SplitPoint());
+        #pragma omp for schedule(dynamic, 8) nowait
+        for (int k = 0; k < (int) pairs.size(); k++)
+            best_split_of_feature(leaves[pairs[k].first], pairs[k].second, best[pairs[k].first]);
+        #pragma omp critical(best_split)
+        {
+            for (int i = 0; i < num_leaves; i++)
+                if (better_split(best[i], splits[i]))
+                    splits[i] = best[i];
+        }
+    }
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <vector>
+#include "tree.h"
+
+/*
+ * Split gain of every candidate threshold of one feature in a single sweep.
+ *
+ * The class totals are read once per feature, and the candidates (sorted, as
+ * uniform_array returns them) are walked against the class-0 and class-1
+ * histograms with forward cursors over their prefix arrays, so the whole
+ * sweep is O(B).
+ */
+
+/*
+ * gains[k] = entropy gain of the split at splits[k] for feature `feature_id`
+ * of `node`. Returns H(Y) of the node, the entropy of SplitPoint.
+ */
+double sweep_gains(TreeNode* node, int feature_id, const vector<float>& splits, vector<float>& gains);
+
+/* index of the first largest gain, or -1 if there is none */
+int argmax_gain(const vector<float>& gains);
+
+/*
+ * Gain kernel (gain_kernel.cpp): gains[k] from the left sums of class 0 and 1
+ * of candidate k, the class totals, the node size and H(Y).
+ *
+ * The SSE4.2 / AVX2 / AVX-512 kernels evaluate 4 / 8 / 16 candidates at once
+ * in single precision with a polynomial log2; they stay within 1e-5 of the
+ * double precision scalar kernel (checked by ./gain-bench). The widest one
+ * the CPU supports is picked at the first call, capped by gain_isa (-g);
+ * by default that is AVX2, AVX-512 is only used when asked for.
+ */
+#define GAIN_ISA_AUTO -1
+#define GAIN_ISA_SCALAR 0
+#define GAIN_ISA_SSE42 1
+#define GAIN_ISA_AVX2 2
+#define GAIN_ISA_AVX512 3
+
+extern int gain_isa;
+
+typedef void (*gain_kernel_t)(int n, double total, double sum_0, double sum_1, double entropy,
+                              const float* left_0, const float* left_1, float* gains);
+gain_kernel_t select_gain_kernel(int isa);
+void compute_gains(int n, double total, double sum_0, double sum_1, double entropy,
+                   const float* left_0, const float* left_1, float* gains);
+
+/*
+ * Evaluate all of `splits` on feature `feature_id` of `node` and keep the
+ * best of them in `best` if it beats the gain already there.
+ */
+void best_of_splits(TreeNode* node, int feature_id, const vector<float>& splits, SplitPoint& best);
+
+/*
+ * Per-thread buffers of split finding. They live for the whole run and only
+ * grow, so once they fit the largest feature find_best_split allocates
+ * nothing, on any leaf or level.
+ */
+struct SplitScratch {
+    // the class histograms of a feature merged, and the candidates they give
+    BinBuffer merged;
+    vector<float> splits;
+    // gain of every candidate
+    vector<float> gains;
+    // left sums of the candidates per class, where they do not fit the stack
+    vector<float> left_0, left_1;
+    // best split of every leaf of best_splits_of_leaves this thread saw
+    vector<SplitPoint> leaf_best;
+    // the (leaf, feature) pairs of the best_splits_of_leaves call of this thread
+    vector<pair<int, int> > leaf_features;
+};
+
+/* the SplitScratch of the calling thread */
+inline SplitScratch& split_scratch() {
+    static thread_local SplitScratch scratch;
+    return scratch;
+}
+
+/*
+ * Merge the class histograms of feature `feature_id` of `node`, take their
+ * uniform_array candidates and keep the best of them in `best`
+ * (best_of_splits), all in the buffers of split_scratch().
+ */
+void best_split_of_feature(TreeNode* node, int feature_id, SplitPoint& best);
+
+/*
+ * Whether `a` beats `b`: a larger gain, or the same gain on a lower feature,
+ * the one a serial search in feature order keeps. Threads that searched
+ * different features combine their best splits with it, in any order.
+ */
+inline bool better_split(const SplitPoint& a, const SplitPoint& b) {
+    return a.gain > b.gain || (a.gain == b.gain && a.feature_id >= 0 && a.feature_id < b.feature_id);
+}
+
+/*
+ * Level-wise split finding: splits[i] = the best split of leaves[i], for all
+ * leaves of a level at once (SplitPoint() for a NULL entry). The (leaf,
+ * feature) pairs of all of them form one flat loop with dynamic scheduling,
+ * so few features still keep the threads busy when there are many leaves,
+ * and there is one parallel region per level instead of one per leaf.
+ * Gives the same splits as best_split_of_feature over each leaf's features.
+ */
+void best_splits_of_leaves(const vector<TreeNode*>& leaves, vector<SplitPoint>& splits);
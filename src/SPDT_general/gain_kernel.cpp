@@ -0,0 +1,165 @@
+#include <math.h>
+#include <string.h>
+#include "gain.h"
+
+// the vector helpers below are always inlined into a kernel of their own ISA
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+int gain_isa = GAIN_ISA_AUTO;
+
+/*
+ * Entropy gain of one candidate, in double precision: the reference the
+ * vector kernels are checked against, and the fallback on other CPUs.
+ * H(Y|X) needs parameters p(X<a), p(Y=0|X<a), p(Y=0|X>=a)
+ * Assuming binary classification problem
+ */
+static inline double entropy_gain(double total_sum, double sum_class_0, double sum_class_1,
+                                  double left_sum_class_0, double left_sum_class_1, double entropy) {
+    double right_sum_class_0 = sum_class_0 - left_sum_class_0;
+    double right_sum_class_1 = sum_class_1 - left_sum_class_1;
+    double left_sum = left_sum_class_0 + left_sum_class_1;
+    double right_sum = right_sum_class_0 + right_sum_class_1;
+
+    double px = (left_sum_class_0 + left_sum_class_1) / total_sum;          // p(x<a)
+    double py_x0 = (left_sum <= EPS) ? 0.f : left_sum_class_0 / left_sum;    // p(y=0|x < a)
+    double py_x1 = (right_sum <= EPS) ? 0.f : right_sum_class_0 / right_sum; // p(y=0|x >= a)
+    dbg_ensures(py_x0 >= -EPS && py_x0 <= 1+EPS);
+    dbg_ensures(py_x1 >= -EPS && py_x1 <= 1+EPS);
+    dbg_ensures(px >= -EPS && px <= 1+EPS);
+    double entropy_left = ((1-py_x0) < EPS || py_x0 < EPS) ? 0 : -py_x0 * log2(py_x0) - (1-py_x0)*log2(1-py_x0);
+    double entropy_right = ((1-py_x1) < EPS || py_x1 < EPS) ? 0 : -py_x1 * log2(py_x1) - (1-py_x1)*log2(1-py_x1);
+    double H_YX = px * entropy_left + (1-px) * entropy_right;
+    // may come out slightly negative for some categorical features
+    return entropy - H_YX;
+}
+
+static void gain_kernel_scalar(int n, double total, double sum_0, double sum_1, double entropy,
+                               const float* left_0, const float* left_1, float* gains) {
+    for (int k = 0; k < n; k++)
+        gains[k] = entropy_gain(total, sum_0, sum_1, left_0[k], left_1[k], entropy);
+}
+
+/*
+ * The same formula on W floats at a time, written once with GCC vector
+ * extensions and compiled for each instruction set below.
+ *
+ * log2 splits x into 2^e * m with m in [sqrt(1/2), sqrt(2)) and evaluates
+ * ln(m) = x - x^2 / 2 + x^3 * P(x), x = m - 1, with the degree 8 polynomial
+ * of the Cephes logf; no division, relative error about 1e-7.
+ */
+template <int W>
+struct Lanes {
+    typedef float vf __attribute__((vector_size(W * 4)));
+    typedef int vi __attribute__((vector_size(W * 4)));
+};
+
+template <class vf, class vi>
+__attribute__((always_inline)) static inline vf fast_log2(vf v) {
+    vi bits = (vi) v;
+    vi e = ((bits >> 23) & 0xff) - 127;
+    vf m = (vf) ((bits & 0x7fffff) | 0x3f800000);
+    vi big = m > 1.41421356f;
+    m = big ? m * 0.5f : m;
+    e = e - big;
+    vf x = m - 1.f;
+    vf z = x * x;
+    vf p = x * 7.0376836292e-2f;
+    p = p - 1.1514610310e-1f;
+    p = p * x + 1.1676998740e-1f;
+    p = p * x - 1.2420140846e-1f;
+    p = p * x + 1.4249322787e-1f;
+    p = p * x - 1.6668057665e-1f;
+    p = p * x + 2.0000714765e-1f;
+    p = p * x - 2.4999993993e-1f;
+    p = p * x + 3.3333331174e-1f;
+    vf ln = x + z * (x * p - 0.5f);
+    return __builtin_convertvector(e, vf) + ln * 1.44269504f;
+}
+
+template <class vf, class vi>
+__attribute__((always_inline)) static inline vf binary_entropy(vf p) {
+    vf q = 1.f - p;
+    // clamp away from 0 so that log2 stays finite in the lanes masked out below
+    vf h = -p * fast_log2<vf, vi>(p < 1e-30f ? 1e-30f : p)
+           - q * fast_log2<vf, vi>(q < 1e-30f ? 1e-30f : q);
+    vi flat = (p < (float) EPS) | (q < (float) EPS);
+    return flat ? 0.f : h;
+}
+
+template <int W>
+__attribute__((always_inline)) static inline typename Lanes<W>::vf
+gain_lanes(float total, float sum_0, float sum_1, float entropy,
+           typename Lanes<W>::vf l0, typename Lanes<W>::vf l1) {
+    typedef typename Lanes<W>::vf vf;
+    typedef typename Lanes<W>::vi vi;
+    vf r0 = sum_0 - l0;
+    vf r1 = sum_1 - l1;
+    vf ls = l0 + l1;
+    vf rs = r0 + r1;
+    vf px = ls * (1.f / total);
+    vf py_x0 = (ls <= (float) EPS) ? 0.f : l0 / ls;
+    vf py_x1 = (rs <= (float) EPS) ? 0.f : r0 / rs;
+    vf H_YX = px * binary_entropy<vf, vi>(py_x0) + (1.f - px) * binary_entropy<vf, vi>(py_x1);
+    return entropy - H_YX;
+}
+
+template <int W>
+__attribute__((always_inline)) static inline void gain_kernel_lanes(int n, float total, float sum_0, float sum_1, float entropy,
+                                                                    const float* left_0, const float* left_1, float* gains) {
+    typedef typename Lanes<W>::vf vf;
+    int k = 0;
+    for (; k + W <= n; k += W) {
+        vf l0, l1;
+        memcpy(&l0, left_0 + k, sizeof(vf));
+        memcpy(&l1, left_1 + k, sizeof(vf));
+        vf g = gain_lanes<W>(total, sum_0, sum_1, entropy, l0, l1);
+        memcpy(gains + k, &g, sizeof(vf));
+    }
+    if (k < n) {
+        // the last candidates go through zero-padded lanes
+        vf l0 = {}, l1 = {};
+        memcpy(&l0, left_0 + k, (n - k) * sizeof(float));
+        memcpy(&l1, left_1 + k, (n - k) * sizeof(float));
+        vf g = gain_lanes<W>(total, sum_0, sum_1, entropy, l0, l1);
+        memcpy(gains + k, &g, (n - k) * sizeof(float));
+    }
+}
+
+__attribute__((target("sse4.2")))
+static void gain_kernel_sse42(int n, double total, double sum_0, double sum_1, double entropy,
+                              const float* left_0, const float* left_1, float* gains) {
+    gain_kernel_lanes<4>(n, total, sum_0, sum_1, entropy, left_0, left_1, gains);
+}
+
+__attribute__((target("avx2,fma")))
+static void gain_kernel_avx2(int n, double total, double sum_0, double sum_1, double entropy,
+                             const float* left_0, const float* left_1, float* gains) {
+    gain_kernel_lanes<8>(n, total, sum_0, sum_1, entropy, left_0, left_1, gains);
+}
+
+__attribute__((target("avx512f,avx512dq,avx512vl,avx512bw")))
+static void gain_kernel_avx512(int n, double total, double sum_0, double sum_1, double entropy,
+                               const float* left_0, const float* left_1, float* gains) {
+    gain_kernel_lanes<16>(n, total, sum_0, sum_1, entropy, left_0, left_1, gains);
+}
+
+/* the widest kernel both the CPU and `isa` allow; AUTO stops at AVX2 */
+gain_kernel_t select_gain_kernel(int isa) {
+    __builtin_cpu_init();
+    bool avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")
+                  && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512bw");
+    bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    bool sse42 = __builtin_cpu_supports("sse4.2");
+    // 512-bit lanes measured slower than AVX2 here (gain-bench), so they are opt-in
+    if (isa == GAIN_ISA_AUTO) isa = GAIN_ISA_AVX2;
+    if (isa >= GAIN_ISA_AVX512 && avx512) return gain_kernel_avx512;
+    if (isa >= GAIN_ISA_AVX2 && avx2) return gain_kernel_avx2;
+    if (isa >= GAIN_ISA_SSE42 && sse42) return gain_kernel_sse42;
+    return gain_kernel_scalar;
+}
+
+void compute_gains(int n, double total, double sum_0, double sum_1, double entropy,
+                   const float* left_0, const float* left_1, float* gains) {
+    static gain_kernel_t kernel = select_gain_kernel(gain_isa);
+    kernel(n, total, sum_0, sum_1, entropy, left_0, left_1, gains);
+}
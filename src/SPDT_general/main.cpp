@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include "tree.h"
+#include "binning.h"
+#include "gain.h"
 #include "timing.h"
 #include <omp.h>
 
@@ -25,7 +27,7 @@ vector<int> featureNum = {123, 22, 1000000, 47236, 54, 300,
                           400};
 
 string help_msg = "-l: max_num_leaf.\n-d: max_depth.\n-n: number of"\
-                  "threads.\n-b: max_bin_size\n-l: max_num_leaf\n-e: min_node_size\n";
+                  "threads.\n-q: pre-quantize the features\n-r: renumber the used features densely\n-t: share max_num_leaf between the subtrees (node-parallel)\n-g: gain kernel (0 scalar, 1 sse4.2, 2 avx2, 3 avx-512)\n-b: max_bin_size\n-l: max_num_leaf\n-e: min_node_size\n";
 int NUM_OF_THREAD = 8;
 int main(int argc, char **argv) {
 
@@ -36,11 +38,23 @@ int main(int argc, char **argv) {
     int c;
     int min_node_size = -1;
     int max_depth = -1;
-    while((c = getopt(argc, argv, "i:n:")) != -1 ){
+    while((c = getopt(argc, argv, "i:n:qg:rt")) != -1 ){
         switch (c)
         {
         case 'i':
             index = (int)std::atoi(optarg);            
+            break;
+        case 'q':
+            use_binning = true;
+            break;
+        case 'r':
+            use_feature_map = true;
+            break;
+        case 't':
+            use_leaf_budget = true;
+            break;
+        case 'g':
+            gain_isa = (int)std::atoi(optarg);
             break;   
         case 'n':
             NUM_OF_THREAD = (int)std::atoi(optarg);
@@ -81,6 +95,8 @@ int main(int argc, char **argv) {
     prefix_printf("NET_SPLIT_TIME: %f\n", SPLIT_TIME - SPLIT_COMMUNICATION_TIME); 
     prefix_printf("COMPRESS_COMMUNICATION_Time: %f\n", COMPRESS_COMMUNICATION_TIME);
     prefix_printf("SPLIT_COMMUNICATION_Time: %f\n", SPLIT_COMMUNICATION_TIME);
+    prefix_printf("HISTOGRAM_PEAK_MB: %f\n", histogram_pool_stats.peak_bytes / 1024.f / 1024.f);
+    prefix_printf("HISTOGRAM_ZEROED_MB: %f\n", histogram_pool_stats.zeroed_bytes / 1024.f / 1024.f);
     prefix_printf("Train_Time: %f\n", cpu_time_used_train);
     prefix_printf("Training_Correct_Rate: %f\n", decisionTree.test(trainDataset));
     t.reset();
@@ -0,0 +1,248 @@
+#pragma once
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Read-only memory mapping of a whole file.
+ * The LIBSVM reader tokenizes the mapped bytes in place, so parsing a row
+ * never copies it into a std::string.
+ */
+class MappedFile {
+public:
+	const char* begin;
+	const char* end;
+	size_t size;
+
+	MappedFile() : begin(NULL), end(NULL), size(0), fd(-1), addr(NULL) {}
+	~MappedFile() { close(); }
+
+	/* return false if the file can not be opened or mapped */
+	bool open(const std::string& name) {
+		close();
+		struct stat st;
+		fd = ::open(name.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		if (fstat(fd, &st) != 0) {
+			close();
+			return false;
+		}
+		size = st.st_size;
+		if (size > 0) {
+			addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (addr == MAP_FAILED) {
+				addr = NULL;
+				close();
+				return false;
+			}
+			madvise(addr, size, MADV_SEQUENTIAL);
+		}
+		begin = (const char*) addr;
+		end = begin + size;
+		return true;
+	}
+
+	void close() {
+		if (addr != NULL) munmap(addr, size);
+		if (fd >= 0) ::close(fd);
+		addr = NULL;
+		fd = -1;
+		begin = end = NULL;
+		size = 0;
+	}
+
+	bool is_open() const { return fd >= 0; }
+
+private:
+	int fd;
+	void* addr;
+	MappedFile(const MappedFile&);
+	MappedFile& operator = (const MappedFile&);
+};
+
+inline bool is_blank(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline bool is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+/* return the position right after the next '\n' (or end) */
+inline const char* next_line(const char* p, const char* end) {
+	const char* q = (const char*) memchr(p, '\n', end - p);
+	return q == NULL ? end : q + 1;
+}
+
+/* return the start of the next non-empty line at or after p (or end) */
+inline const char* next_row(const char* p, const char* end) {
+	while (p < end) {
+		const char* q = p;
+		while (q < end && is_blank(*q)) q++;
+		if (q == end) return end;
+		if (*q != '\n') return p;
+		p = q + 1;
+	}
+	return end;
+}
+
+/*
+ * Walk over at most `rows` non-empty lines starting at p.
+ * `found` returns how many rows were walked over.
+ * Return the position right after the last of them.
+ */
+inline const char* skip_rows(const char* p, const char* end, int rows, int& found) {
+	found = 0;
+	while (found < rows) {
+		p = next_row(p, end);
+		if (p == end) break;
+		p = next_line(p, end);
+		found++;
+	}
+	return p;
+}
+
+/* number of non-empty lines in [p, end) */
+inline int count_rows(const char* p, const char* end) {
+	int found = 0;
+	skip_rows(p, end, 0x7fffffff, found);
+	return found;
+}
+
+/* number of ':' in [p, end), never less than the index:value entries there */
+inline long long count_entries(const char* p, const char* end) {
+	long long found = 0;
+	while ((p = (const char*) memchr(p, ':', end - p)) != NULL) {
+		found++;
+		p++;
+	}
+	return found;
+}
+
+/*
+ * Split [begin, end) into at most `parts` chunks for parallel parsing.
+ * Every boundary falls right after a '\n', so no row straddles two chunks.
+ * bounds[k] and bounds[k + 1] delimit chunk k.
+ */
+inline void split_at_lines(const char* begin, const char* end, int parts, std::vector<const char*>& bounds) {
+	// below this size a chunk is not worth a thread
+	const size_t min_chunk = 1 << 16;
+	size_t size = end - begin;
+	if (parts < 1) parts = 1;
+	if (size / parts < min_chunk) parts = (int) (size / min_chunk) + 1;
+	bounds.clear();
+	bounds.push_back(begin);
+	for (int k = 1; k < parts; k++) {
+		const char* p = begin + size * k / parts;
+		if (p < bounds.back()) p = bounds.back();
+		p = (p == begin) ? begin : next_line(p - 1, end);
+		bounds.push_back(p);
+	}
+	bounds.push_back(end);
+}
+
+/*
+ * from_chars-style integer parsing: read [+-]digits starting at p.
+ * Return the position after the number, or p itself if there is no number.
+ */
+inline const char* parse_int(const char* p, const char* end, int& out) {
+	const char* s = p;
+	bool neg = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		neg = (*p == '-');
+		p++;
+	}
+	if (p == end || !is_digit(*p)) return s;
+	long long v = 0;
+	while (p < end && is_digit(*p)) {
+		v = v * 10 + (*p - '0');
+		p++;
+	}
+	out = (int) (neg ? -v : v);
+	return p;
+}
+
+/*
+ * from_chars-style floating-point parsing of [+-]digits[.digits][(e|E)[+-]digits].
+ * Numbers with at most 19 significant digits and a small decimal exponent are
+ * converted exactly (Clinger's fast path), everything else goes through strtod
+ * on a stack copy of the token. Return p itself if there is no number.
+ */
+inline const char* parse_double(const char* p, const char* end, double& out) {
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	const char* s = p;
+	bool neg = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		neg = (*p == '-');
+		p++;
+	}
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool any = false;
+	while (p < end && is_digit(*p)) {
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa) digits++;
+		} else {
+			exponent++;
+		}
+		any = true;
+		p++;
+	}
+	if (p < end && *p == '.') {
+		p++;
+		while (p < end && is_digit(*p)) {
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa) digits++;
+				exponent--;
+			}
+			any = true;
+			p++;
+		}
+	}
+	if (!any) {
+		// nan, inf and friends
+		char buf[64];
+		size_t n = 0;
+		while (s + n < end && n + 1 < sizeof(buf) && !is_blank(s[n]) && s[n] != '\n') {
+			buf[n] = s[n];
+			n++;
+		}
+		buf[n] = '\0';
+		char* stop;
+		out = strtod(buf, &stop);
+		return s + (stop - buf);
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		int e = 0;
+		const char* q = parse_int(p + 1, end, e);
+		if (q != p + 1) {
+			exponent += e;
+			p = q;
+		}
+	}
+	if (mantissa < (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+		double v = (double) mantissa;
+		v = (exponent < 0) ? v / pow10[-exponent] : v * pow10[exponent];
+		out = neg ? -v : v;
+		return p;
+	}
+	char buf[128];
+	size_t n = p - s;
+	if (n >= sizeof(buf)) n = sizeof(buf) - 1;
+	memcpy(buf, s, n);
+	buf[n] = '\0';
+	out = strtod(buf, NULL);
+	return p;
+}
@@ -1,36 +1,47 @@
 #include "parser.h"
 #include "tree.h"
 
-double Data::get_value(int feature_id) {
-	if (values.find(feature_id) == values.end()) {
+float Data::get_value(int feature_id) {
+	const int* p = lower_bound(index, index + num_values, feature_id);
+	if (p == index + num_values || *p != feature_id) {
 		return 0;
 	}
-	return values[feature_id];
+	return value[p - index];
 }
 
-void Data::read_a_data(ifstream* myfile) {	
+void RowStore::clear() {
+	labels.clear();
+	row_offset.clear();
+	row_offset.push_back(0);
+	feature_index.clear();
+	feature_value.clear();
+}
+
+/*
+ * Parse one LIBSVM row "label index:value index:value ..." in place into
+ * row `row` of the store, which is already sized. Its values are written
+ * from entry `next` on, and `next` is moved past them.
+ * Return the position right after the row.
+ */
+const char* RowStore::read_a_data(const char* p, const char* end, int row, long long& next) {	
 	int index;
+	int label = 0;
 	double tmpvalue;	
 	
 	bool isFirst = true;
+	bool sorted = true;
+	long long begin = next;
+	const char* eol = next_line(p, end);
 
-	string str, prev, indexstr, valuestr;
-	getline(*myfile, str);	
-
-	size_t npos;
-
-	// cout << "str: " << str << endl;	
-
-	while (str.size() > 0) {
-		npos = str.find(' ');
-		if (npos == string::npos) break;
-		prev = str.substr(0, npos);		
-		str = str.substr(npos + 1);
-		if (prev.size() == 0 || prev[0] < '+') continue;				
+	while (p < eol) {
+		while (p < eol && (is_blank(*p) || *p == '\n')) p++;
+		if (p == eol) break;
+		if (*p < '+') {
+			while (p < eol && !is_blank(*p) && *p != '\n') p++;
+			continue;
+		}
 		if (isFirst) {
-			// cout << "prev: " << prev << endl;
-			label = stoi(prev);
-			// cout << "label: " << label << endl;
+			p = parse_int(p, eol, label);
 			
 			if (label != POS_LABEL && num_of_classes == 2) label = 0;
 			if (num_of_classes > 2) {
@@ -39,42 +50,309 @@ void Data::read_a_data(ifstream* myfile) {
 
 			isFirst = false;
 		} else {
-			// cout << "prev: " << prev << endl;
-			npos = prev.find(':');
-			indexstr = prev.substr(0, npos);
-			// cout << "indexstr: " << indexstr << endl;
-			index = stoi(indexstr);
-			valuestr = prev.substr(npos + 1);
-			// cout << "valuestr: " << valuestr << endl;
-			tmpvalue = stod(valuestr);
-			// cout << "index: " << index << "tmpvalue: " << tmpvalue << endl;
-			values[index - 1] = tmpvalue;
+			const char* q = parse_int(p, eol, index);
+			if (q != p && q < eol && *q == ':' && index >= 1) {
+				p = parse_double(q + 1, eol, tmpvalue);
+				if (next > begin && feature_index[next - 1] >= index - 1)
+					sorted = false;
+				feature_index[next] = index - 1;
+				feature_value[next] = tmpvalue;
+				next++;
+			} else {
+				p = q;
+			}
 		}
+		// skip whatever is left of a malformed token
+		while (p < eol && !is_blank(*p) && *p != '\n') p++;
 	}
+
+	if (!sorted) {
+		// rare: sort by feature id, the last duplicate wins
+		vector<pair<int, float> > entries;
+		for (long long k = begin; k < next; k++)
+			entries.push_back(make_pair(feature_index[k], feature_value[k]));
+		stable_sort(entries.begin(), entries.end(), 
+			[](const pair<int, float>& a, const pair<int, float>& b) {
+				return a.first < b.first;
+			});
+		next = begin;
+		for (size_t k = 0; k < entries.size(); k++) {
+			if (next > begin && feature_index[next - 1] == entries[k].first) {
+				feature_value[next - 1] = entries[k].second;
+				continue;
+			}
+			feature_index[next] = entries[k].first;
+			feature_value[next] = entries[k].second;
+			next++;
+		}
+	}
+	labels[row] = label;
+	row_offset[row + 1] = next;
+	return eol;
 }
 
 void Dataset::open_read_data(string name) {
-	myfile.open(name, fstream::in);
+	if (use_binary_cache && cache.open(name, num_of_classes)) {
+		if (cache.num_rows() < num_of_data) num_of_data = cache.num_rows();
+		return;
+	}
+	if (!myfile.open(name)) {
+		fprintf(stderr, "ERROR: can not open %s\n", name.c_str());
+		exit(-1);
+	}
+	cursor = myfile.begin;
+	if (use_binary_cache && !cache_writer.open(name, num_of_classes)) {
+		fprintf(stderr, "WARNING: can not write the binary cache of %s\n", name.c_str());
+	}
+}
+
+/*
+ * Open only shard `shard_id` out of `num_shards` equal row ranges of the
+ * first num_of_data rows, so that each MPI rank parses and keeps its own rows.
+ * The start of the range is found through the binary cache or the row index
+ * sidecar ("<name>.idx", built on first use). A shard never writes the cache.
+ */
+void Dataset::open_shard(string name, int shard_id, int num_shards) {
+	long long total;
+	RowIndex index;
+	if (use_binary_cache && cache.open(name, num_of_classes)) {
+		total = cache.num_rows();
+	} else {
+		if (!myfile.open(name)) {
+			fprintf(stderr, "ERROR: can not open %s\n", name.c_str());
+			exit(-1);
+		}
+		index.open(name, myfile.begin, myfile.end);
+		total = index.num_rows();
+	}
+	if (total > num_of_data) total = num_of_data;
+	long long per_shard = (total + num_shards - 1) / num_shards;
+	long long begin = min(total, shard_id * per_shard);
+	long long end = min(total, begin + per_shard);
+	first_row = begin;
+	num_of_data = end - begin;
+	if (!cache.is_open()) {
+		cursor = myfile.begin + index.offset(begin, myfile.size);
+	}
+}
+
+/*
+ * Point one row view per row at CSR arrays, which may live in `rows`
+ * or in the mapped cache.
+ */
+void Dataset::set_views(vector<Data>& views, int n, const int* labels, const long long* row_offset, 
+	const int* index, const float* value) {
+	views.resize(n);
+	for (int i = 0; i < n; i++) {
+		views[i].label = labels[i];
+		views[i].num_values = row_offset[i + 1] - row_offset[i];
+		views[i].index = index + row_offset[i];
+		views[i].value = value + row_offset[i];
+		views[i].bin8 = NULL;
+		views[i].bin16 = NULL;
+	}
+}
+
+/* take the next N rows straight from the mapped cache, return how many */
+int Dataset::read_cached_batch(int N, Batch& out) {
+	long long row = (long long) first_row + read_rows;
+	long long left = cache.num_rows() - row;
+	int found = (left < N) ? (int) left : N;
+	if (found <= 0) return 0;
+	const int* labels = cache.labels + row;
+	set_views(out.dataset, found, labels, cache.row_offset + row, 
+		cache.feature_index, cache.feature_value);
+	for (int i = 0; i < found; i++) {
+		if (labels[i] == POS_LABEL) out.num_pos_label++;
+	}
+	return found;
+}
+
+/*
+ * Run body(k) for every chunk k in [0, n), each on a thread of its own and
+ * chunk 0 on the caller. std::thread rather than OpenMP, so that the
+ * trainers built without -fopenmp (sequential, MPI) parse in parallel too.
+ */
+template <class Body>
+static void for_each_chunk(int n, Body body) {
+	vector<std::thread> pool;
+	for (int k = 1; k < n; k++)
+		pool.emplace_back(body, k);
+	if (n > 0) body(0);
+	for (auto& t : pool)
+		t.join();
 }
 
-/* return whether there are still data left or not */
+/* parse the next N rows of the text file into `out` on `workers` threads, return how many */
+int Dataset::read_text_batch(int N, Batch& out, int workers) {	
+	const char* end = myfile.end;
+	int found = 0;
+	const char* batch_begin = cursor;
+	const char* batch_end = cursor;
+	if (cursor != NULL && N > 0) {
+		batch_end = skip_rows(cursor, end, N, found);
+	}
+
+	// split the batch at line boundaries and count the rows and the ':' of
+	// every chunk, so that the chunks parse in parallel straight into their
+	// rows of the batch.
+	vector<const char*> bounds;
+	split_at_lines(batch_begin, batch_end, workers, bounds);
+	int num_chunks = bounds.size() - 1;
+	vector<int> row_begin(num_chunks + 1, 0);
+	vector<long long> value_begin(num_chunks + 1, 0);
+	for_each_chunk(num_chunks, [&](int k) {
+		row_begin[k + 1] = count_rows(bounds[k], bounds[k + 1]);
+		value_begin[k + 1] = count_entries(bounds[k], bounds[k + 1]);
+	});
+	for (int k = 0; k < num_chunks; k++) {
+		row_begin[k + 1] += row_begin[k];
+		value_begin[k + 1] += value_begin[k];
+	}
+	dbg_assert(row_begin[num_chunks] == found);
+
+	RowStore& rows = out.rows;
+	rows.labels.resize(found);
+	rows.row_offset.resize(found + 1);
+	rows.feature_index.resize(value_begin[num_chunks]);
+	rows.feature_value.resize(value_begin[num_chunks]);
+	vector<long long> value_end(num_chunks);
+	vector<int> chunk_pos(num_chunks, 0);
+	for_each_chunk(num_chunks, [&](int k) {
+		const char* p = bounds[k];
+		long long next = value_begin[k];
+		for (int i = row_begin[k]; i < row_begin[k + 1]; i++) {
+			p = next_row(p, bounds[k + 1]);
+			p = rows.read_a_data(p, bounds[k + 1], i, next);
+			if (rows.labels[i] == POS_LABEL) chunk_pos[k]++;
+		}
+		value_end[k] = next;
+	});
+	int pos = 0;
+	for (int k = 0; k < num_chunks; k++)
+		pos += chunk_pos[k];
+
+	// a ':' that gave no value (a malformed token, a duplicate id) leaves
+	// a gap after its chunk, closed here
+	long long used = 0;
+	for (int k = 0; k < num_chunks; k++) {
+		long long shift = value_begin[k] - used;
+		if (shift > 0) {
+			move(rows.feature_index.begin() + value_begin[k], rows.feature_index.begin() + value_end[k], 
+				rows.feature_index.begin() + used);
+			move(rows.feature_value.begin() + value_begin[k], rows.feature_value.begin() + value_end[k], 
+				rows.feature_value.begin() + used);
+			for (int i = row_begin[k]; i < row_begin[k + 1]; i++)
+				rows.row_offset[i + 1] -= shift;
+		}
+		used += value_end[k] - value_begin[k];
+	}
+	rows.row_offset[0] = 0;
+	rows.feature_index.resize(used);
+	rows.feature_value.resize(used);
+
+	set_views(out.dataset, found, rows.labels.data(), rows.row_offset.data(), 
+		rows.feature_index.data(), rows.feature_value.data());
+	out.num_pos_label = pos;
+	cursor = batch_end;
+
+	cache_writer.append(found, rows.labels.data(), rows.row_offset.data(), 
+		rows.feature_index.data(), rows.feature_value.data(), POS_LABEL);
+	// only a completely parsed file is worth caching
+	if (cache_writer.is_open() && next_row(cursor, end) == end) {
+		cache_writer.finish();
+	}
+	return found;
+}
+
+/* read the next N rows from the cache or the text file into `out` */
+void Dataset::read_batch(int N, Batch& out, int workers) {
+	out.rows.clear();
+	out.dataset.clear();
+	out.num_pos_label = 0;
+	out.want = min(N, num_of_data - read_rows);
+	out.found = cache.is_open() ? read_cached_batch(out.want, out) : read_text_batch(out.want, out, workers);
+	read_rows += out.found;
+}
+
+/* make `b` the current batch, `b` gets the storage of the previous one */
+void Dataset::take_batch(Batch& b) {
+	// swapping vectors keeps their buffers, so the row views stay valid
+	rows.labels.swap(b.rows.labels);
+	rows.row_offset.swap(b.rows.row_offset);
+	rows.feature_index.swap(b.rows.feature_index);
+	rows.feature_value.swap(b.rows.feature_value);
+	dataset.swap(b.dataset);
+	num_pos_label += b.num_pos_label;
+	already_read_data += b.found;
+
+	// the file holds fewer rows than requested
+	if (b.found < b.want) {
+		num_of_data = already_read_data;
+	}
+}
+
+/*
+ * Body of the background reader: parse batches of N rows into the spare
+ * buffer until the data runs out. The bounded queues keep it at most one
+ * batch ahead of the trainer. It parses on its own thread only, as the
+ * trainer's threads are busy meanwhile; parser-bench -p measures the cost.
+ */
+void Dataset::prefetch_loop(int N) {
+	Batch* b;
+	while (free_batches.pop(b)) {
+		read_batch(N, *b, 1);
+		bool last = (b->found < b->want) || (read_rows >= num_of_data);
+		if (!prefetched.push(b) || last) break;
+	}
+	prefetched.close();
+}
+
+void Dataset::stop_prefetch() {
+	if (!reader.joinable()) return;
+	free_batches.close();
+	prefetched.close();
+	reader.join();
+	free_batches.reopen();
+	prefetched.reopen();
+}
+
+/*
+ * Return whether there are still data left or not.
+ * The first call reads synchronously. If more batches follow and
+ * use_prefetch is set, a background thread then parses batch k + 1 while
+ * batch k is in use, so later calls must ask for the same N.
+ */
 bool Dataset::streaming_read_data(int N) {	
-	dataset.clear();
-	dataset.shrink_to_fit();
-	dataset = vector<Data>(N);
-
-	for (int i = 0; i < N; i++) {
-		dataset[i].read_a_data(&myfile);		
-		if (dataset[i].label == POS_LABEL) num_pos_label++;
-		already_read_data++;
-		if (already_read_data == num_of_data) {
-			break;
+	if (reader.joinable()) {
+		Batch* b;
+		if (prefetched.pop(b)) {
+			take_batch(*b);
+			free_batches.push(b);
+		} else {
+			// the reader is done, but the caller asked for more
+			rows.clear();
+			dataset.clear();
 		}
+		return (already_read_data < num_of_data);
 	}
 
+	read_batch(N, spare, NUM_OF_THREAD);
+	take_batch(spare);
+	if (use_prefetch && already_read_data < num_of_data) {
+		free_batches.push(&spare);
+		reader = std::thread(&Dataset::prefetch_loop, this, N);
+	}
 	return (already_read_data < num_of_data);
 }
 
+/*
+ * Release the text file. A mapped cache stays until the Dataset goes away,
+ * because the row views of the last batch point into it.
+ */
 void Dataset::close_read_data() {
+	stop_prefetch();
 	myfile.close();
-}
\ No newline at end of file
+	cursor = NULL;
+	cache_writer.discard();
+}
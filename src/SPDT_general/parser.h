@@ -1,45 +1,148 @@
 #pragma once
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 #include "array.h"
+#include "mmap_reader.h"
+#include "binary_cache.h"
+#include "row_index.h"
+#include "bounded_queue.h"
 
 using namespace std;
 #define POS_LABEL 1
 #define NEG_LABEL 0
 
+/*
+ * One row of a Dataset. A Data does not own memory: `index` and `value`
+ * point into the CSR arrays of the batch that holds the row.
+ */
 class Data {
 public:
 	int label;
-	unordered_map<int, double> values;
-	double get_value(int feature_id);
-	void read_a_data(ifstream* myfile);
+	int num_values;
+	const int* index; // feature ids, sorted in increasing order
+	const float* value;
+	// bin index of every value once the batch is quantized (see binning.h), else NULL
+	const uint8_t* bin8;
+	const uint16_t* bin16;
+	float get_value(int feature_id);
+
+	inline int bin_at(int k) {
+		return (bin8 != NULL) ? bin8[k] : bin16[k];
+	}
+
+	/*
+	 * Value of `feature_id` when the features are visited in increasing order.
+	 * `k` is the walking position in the row and starts at 0.
+	 */
+	inline float next_value(int feature_id, int& k) {
+		if (k < num_values && index[k] == feature_id) return value[k++];
+		return 0;
+	}
+};
+
+/*
+ * Rows in compressed sparse row (CSR) form.
+ * Row i holds entries [row_offset[i], row_offset[i + 1]) of
+ * feature_index / feature_value.
+ */
+class RowStore {
+public:
+	vector<int> labels;
+	vector<long long> row_offset;
+	vector<int> feature_index;
+	vector<float> feature_value;
+
+	RowStore() {row_offset.push_back(0);}
+	int size() {return labels.size();}
+	void clear();
+	const char* read_a_data(const char* p, const char* end, int row, long long& next);
+};
+
+/*
+ * One batch as it is handed from the background reader to the trainer.
+ */
+class Batch {
+public:
+	RowStore rows;
+	vector<Data> dataset;
+	int want;  // rows asked for
+	int found; // rows read, fewer than `want` at the end of the file
+	int num_pos_label;
 };
 
 class Dataset {
 public:	
 	int num_of_data;
 	int num_pos_label;
+	// CSR storage of the current batch, and one view per row into it
+	RowStore rows;
 	vector<Data> dataset;	
-	ifstream myfile;
+	// bin indices of the current batch, filled by FeatureBins::quantize
+	vector<uint8_t> bin8;
+	vector<uint16_t> bin16;
+	MappedFile myfile;
+	const char* cursor;
+	// binary cache of the file: read from it when present, written otherwise
+	BinaryCache cache;
+	BinaryCacheWriter cache_writer;
+	bool use_binary_cache;
+	// row of the file the Dataset starts at, non-zero only for a shard
+	int first_row;
+	// parse the next batch in the background while the current one is used
+	bool use_prefetch;
 
 	int already_read_data;
 
-	Dataset() {num_pos_label=0;}
+	Dataset() : prefetched(1), free_batches(1) {
+		num_pos_label=0; already_read_data=0; cursor=NULL; use_binary_cache=true; first_row=0;
+		use_prefetch=true; read_rows=0;
+	}
 	Dataset(int _num_of_data):		
-		num_of_data(_num_of_data) {
+		num_of_data(_num_of_data), prefetched(1), free_batches(1) {
 		already_read_data = 0;
 		num_pos_label=0;
+		cursor=NULL;
+		use_binary_cache=true;
+		first_row=0;
+		use_prefetch=true;
+		read_rows=0;
 	}
+	~Dataset() {stop_prefetch();}
 
 	void open_read_data(string name);
+	void open_shard(string name, int shard_id, int num_shards);
 
 	bool streaming_read_data(int N);
+	int read_text_batch(int N, Batch& out, int workers);
+	int read_cached_batch(int N, Batch& out);
+	void set_views(vector<Data>& views, int n, const int* labels, const long long* row_offset, 
+		const int* index, const float* value);
 
 	void close_read_data();
 
+	// raw feature ids the rows can hold, fewer than num_of_features if the cache knows it
+	int raw_features() const {
+		return cache.is_open() ? std::min(num_of_features, cache.max_feature()) : num_of_features;
+	}
+
 	void print_dataset();
 
+private:
+	// rows read from the file so far, ahead of already_read_data while prefetching
+	int read_rows;
+	// double buffering: the trainer uses `rows`, the reader fills `spare`
+	Batch spare;
+	std::thread reader;
+	BoundedQueue<Batch*> prefetched;
+	BoundedQueue<Batch*> free_batches;
+
+	void read_batch(int N, Batch& out, int workers);
+	void take_batch(Batch& b);
+	void prefetch_loop(int N);
+	void stop_prefetch();
 };
\ No newline at end of file
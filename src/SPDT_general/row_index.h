@@ -0,0 +1,107 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "mmap_reader.h"
+#include "binary_cache.h"
+
+/*
+ * Byte offset of every row of a LIBSVM text file, so that a reader can seek
+ * straight to row i instead of parsing everything in front of it.
+ *
+ * The index is built in one pass over the file and saved next to it as
+ * "<name>.idx" (BinaryHeader-like header, then int64 offsets[num_rows]).
+ */
+
+#define ROW_INDEX_MAGIC "SPDTIDX"
+#define ROW_INDEX_VERSION 1
+
+struct RowIndexHeader {
+	char magic[8];
+	int32_t version;
+	int32_t reserved;
+	int64_t num_rows;
+	int64_t source_size;
+	int64_t source_mtime;
+};
+
+inline std::string row_index_name(const std::string& name) {
+	return name + ".idx";
+}
+
+class RowIndex {
+public:
+	RowIndex() : offsets(NULL), rows(0) {}
+
+	/*
+	 * Load the sidecar of `source`, or build it from the mapped text
+	 * [begin, end) and try to save it for the next run.
+	 */
+	void open(const std::string& source, const char* begin, const char* end) {
+		if (load(source)) return;
+		built.clear();
+		const char* p = next_row(begin, end);
+		while (p < end) {
+			built.push_back(p - begin);
+			p = next_row(next_line(p, end), end);
+		}
+		offsets = (const int64_t*) built.data();
+		rows = built.size();
+		save(source);
+	}
+
+	long long num_rows() const { return rows; }
+
+	/* byte offset of row i, the file size for i == num_rows() */
+	long long offset(long long i, long long file_size) const {
+		return (i < rows) ? offsets[i] : file_size;
+	}
+
+private:
+	MappedFile file;
+	std::vector<int64_t> built;
+	const int64_t* offsets;
+	long long rows;
+
+	bool load(const std::string& source) {
+		if (!file.open(row_index_name(source))) return false;
+		const RowIndexHeader* header = (const RowIndexHeader*) file.begin;
+		int64_t size, mtime;
+		bool ok = file.size >= sizeof(RowIndexHeader)
+			&& memcmp(header->magic, ROW_INDEX_MAGIC, 8) == 0
+			&& header->version == ROW_INDEX_VERSION
+			&& file_signature(source, size, mtime)
+			&& size == header->source_size && mtime == header->source_mtime
+			&& file.size >= sizeof(RowIndexHeader) + header->num_rows * sizeof(int64_t);
+		if (!ok) {
+			file.close();
+			return false;
+		}
+		offsets = (const int64_t*) (file.begin + sizeof(RowIndexHeader));
+		rows = header->num_rows;
+		return true;
+	}
+
+	/* write "<source>.idx" through an atomic rename */
+	void save(const std::string& source) {
+		RowIndexHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, ROW_INDEX_MAGIC, 8);
+		header.version = ROW_INDEX_VERSION;
+		header.num_rows = rows;
+		file_signature(source, header.source_size, header.source_mtime);
+		std::string name = row_index_name(source);
+		std::string tmp = name + ".tmp." + std::to_string((long long) getpid());
+		FILE* out = fopen(tmp.c_str(), "wb");
+		if (out == NULL) return;
+		bool ok = fwrite(&header, sizeof(header), 1, out) == 1
+			&& fwrite(offsets, sizeof(int64_t), rows, out) == (size_t) rows;
+		ok = (fclose(out) == 0) && ok;
+		if (!ok || rename(tmp.c_str(), name.c_str()) != 0) remove(tmp.c_str());
+	}
+
+	RowIndex(const RowIndex&);
+	RowIndex& operator = (const RowIndex&);
+};
@@ -7,6 +7,7 @@
 #include <math.h>
 #include <time.h>
 #include "../SPDT_general/array.h"
+#include "../SPDT_general/binning.h"
 #include "../SPDT_general/timing.h"
 
 double COMPRESS_TIME = 0.f;
@@ -19,11 +20,14 @@ int num_of_features = -1;
 int num_of_classes = -1;
 int max_bin_size = -1;
 int max_num_leaves = -1;
+bool use_leaf_budget = false;
 
 SplitPoint::SplitPoint()
 {
     feature_id = -1;
     feature_value = 0;
+    // below any real candidate
+    gain = -1;
     entropy = 0;
 }
 
@@ -31,6 +35,7 @@ SplitPoint::SplitPoint(int feature_id, float feature_value)
 {
     this->feature_id = feature_id;
     this->feature_value = feature_value;
+    this->gain = -1;
     this->entropy = 0;
 }
 /*
@@ -78,6 +83,8 @@ void TreeNode::init()
  */
 void TreeNode::set_label()
 {
+    release_histogram(this->histogram_id);
+    this->histogram_id = -1;
     this->is_leaf = true;
     this->label = (this->num_pos_label >= (int)this->data_size / 2) ? POS_LABEL : NEG_LABEL;
 }
@@ -153,7 +160,11 @@ bool DecisionTree::is_terminated(TreeNode *node)
         return true;
     }
 
-    if (max_num_leaves != -1 && this->num_leaves >= max_num_leaves)
+    // the node-parallel trainer labels leaves in several tasks at once
+    int leaves;
+    #pragma omp atomic read
+    leaves = this->num_leaves;
+    if (max_num_leaves != -1 && leaves >= max_num_leaves)
     {
         dbg_printf("Node [%d] terminated: max_num_leaves\n", node->id);
         return true;
@@ -171,14 +182,8 @@ bool DecisionTree::is_terminated(TreeNode *node)
 void DecisionTree::initialize(Dataset &train_data, const int batch_size){
     this->datasetPointer = &train_data;
     root = new TreeNode(0, this->num_nodes++);  
-    if (histogram != NULL) {        
-        delete[] histogram;
-    }
-    SIZE  = (long long)max_num_leaves * num_of_features * num_of_classes * ((max_bin_size + 1) * 2 + 1);    
+    SIZE = alloc_histograms(max_num_leaves);
     // printf("Init Root Node [%.4f] MB\n", SIZE * sizeof(float) / 1024.f / 1024.f);
-    
-    histogram = new float[SIZE];
-    memset(histogram, 0, SIZE * sizeof(float));  
     // printf("Init success\n");
 
 }
@@ -187,8 +192,27 @@ void DecisionTree::train(Dataset &train_data, const int batch_size)
 {
     int hasNext = TRUE;
     initialize(train_data, batch_size);
+    if (use_feature_map) {
+        feature_map.reset(train_data.raw_features());
+    }
 	while (TRUE) {
 		hasNext = train_data.streaming_read_data(batch_size);	
+        if (use_feature_map) {
+            vector<char> used;
+            feature_map.mark_used(train_data.dataset, used);
+            feature_map.extend(used);
+            feature_map.remap(train_data);
+            num_of_features = feature_map.size();
+        }
+        if (use_binning) {
+            // cut points come from the first batch and stay fixed
+            if (!feature_bins.ready()) {
+                feature_bins.build(train_data.dataset, max_bin_size);
+                // features first seen later would have no bins
+                feature_map.freeze();
+            }
+            feature_bins.quantize(train_data);
+        }
         dbg_printf("Train size (%d, %d, %d)\n", train_data.num_of_data, 
                 num_of_features, num_of_classes);
         train_on_batch(train_data);        
@@ -196,65 +220,52 @@ void DecisionTree::train(Dataset &train_data, const int batch_size)
 	}		
     
 	train_data.close_read_data(); 
+    if (use_feature_map) {
+        restore_raw_features(train_data);
+    }
     return;
 }
 
+/*
+ * Translate the splits of the trained tree from dense to raw feature ids,
+ * so the model can be applied to rows as they are read. The last training
+ * batch is still in memory and gets its raw ids back too.
+ */
+void DecisionTree::restore_raw_features(Dataset &train_data)
+{
+    queue<TreeNode *> q;
+    q.push(root);
+    while (!q.empty())
+    {
+        TreeNode *node = q.front();
+        q.pop();
+        if (node->is_leaf)
+            continue;
+        node->split_ptr.feature_id = feature_map.raw_id[node->split_ptr.feature_id];
+        q.push(node->left_node);
+        q.push(node->right_node);
+    }
+    feature_map.restore(train_data);
+    num_of_features = feature_map.raw_size();
+}
+
 double DecisionTree::test(Dataset &test_data) {    
 
     int i = 0;
     int correct_num = 0;
-    test_data.streaming_read_data(test_data.num_of_data);
+    // the training set is still in memory after the last batch
+    if (test_data.already_read_data < test_data.num_of_data)
+        test_data.streaming_read_data(test_data.num_of_data);
 
-    for (i = 0; i < test_data.num_of_data; i++) {
+    for (i = 0; i < (int) test_data.dataset.size(); i++) {
         assert(navigate(test_data.dataset[i])->label != -1);
         if (navigate(test_data.dataset[i])->label == test_data.dataset[i].label) {
             correct_num++;
         }
     }    
-    return (double)correct_num / (double)test_data.num_of_data;
-}
-
-/*
- * Calculate the entropy gain = H(Y) - H(Y|X)
- * H(Y|X) needs parameters p(X<a), p(Y=0|X<a), p(Y=0|X>=a)
- * Assuming binary classification problem
- */
-void get_gain(TreeNode* node, SplitPoint& split, int feature_id){
-    int total_sum = node->data_size;
-    dbg_ensures(total_sum > 0);
-    double sum_class_0 = get_total_array(node->histogram_id, feature_id, NEG_LABEL);
-    double sum_class_1 = get_total_array(node->histogram_id, feature_id, POS_LABEL);
-    dbg_assert((sum_class_1 - node->num_pos_label) < EPS);
-    double left_sum_class_0 = sum_array(node->histogram_id, feature_id, NEG_LABEL, split.feature_value);
-    double right_sum_class_0 = sum_class_0 - left_sum_class_0;
-    double left_sum_class_1 = sum_array(node->histogram_id, feature_id, POS_LABEL, split.feature_value);
-    double right_sum_class_1 = sum_class_1 - left_sum_class_1;
-    double left_sum = left_sum_class_0 + left_sum_class_1;
-    double right_sum = right_sum_class_0 + right_sum_class_1;
-
-    double px = (left_sum_class_0 + left_sum_class_1) / (1.0 * total_sum); // p(x<a)
-    double py_x0 = (left_sum <= EPS) ? 0.f : left_sum_class_0 / left_sum;                            // p(y=0|x < a)
-    double py_x1 = (right_sum <= EPS) ? 0.f : right_sum_class_0 / right_sum;                          // p(y=0|x >= a)
-    // printf("id=%d, value=%.f\n", split.feature_id, split.feature_value);
-    // printf("left_sum_class_0=%f, left_sum_class_1=%f\n", left_sum_class_0, left_sum_class_1);
-    
-    // printf("sum_class_1=%f, sum_class_0=%f, right_sum = %f, right_sum_class_0 = %f right_sum_class_1= %f\n", sum_class_1, sum_class_0, right_sum, right_sum_class_0, right_sum_class_1);
-    // printf("px = %.f, py_x0 = %f, py_x1 = %f\n", px, py_x0, py_x1);
-    dbg_ensures(py_x0 >= -EPS && py_x0 <= 1+EPS);
-    dbg_ensures(py_x1 >= -EPS && py_x1 <= 1+EPS);
-    dbg_ensures(px >= -EPS && px <= 1+EPS);
-    double entropy_left = ((1-py_x0) < EPS || py_x0 < EPS) ? 0 : -py_x0 * log2(py_x0) - (1-py_x0)*log2(1-py_x0);
-    double entropy_right = ((1-py_x1) < EPS || py_x1 < EPS) ? 0 : -py_x1 * log2(py_x1) - (1-py_x1)*log2(1-py_x1);
-    double H_YX = px * entropy_left + (1-px) * entropy_right;
-    double px_prior = sum_class_0 / (sum_class_0 + sum_class_1);
-    dbg_ensures(px_prior > 0 && px_prior < 1);
-    split.entropy = ((1-px_prior) < EPS || px_prior < EPS) ? 0 : -px_prior * log2(px_prior) - (1-px_prior) * log2(1-px_prior);
-    split.gain = split.entropy - H_YX;
-    // printf("%f = %f - %f\n", split.gain, split.entropy, H_YX);
-    dbg_ensures(split.gain >= -EPS);
+    return (double)correct_num / (double)test_data.dataset.size();
 }
 
-
 void DecisionTree::self_check(){
     queue<TreeNode *> q;
     q.push(root);
@@ -366,8 +377,20 @@ TreeNode *DecisionTree::navigate(Data &d)
 }
 
 /*
- * This function initialize the histogram for each unlabeled leaf node.
- * Also, potentially, it would free the previous histogram.
+ * A leaf at max_depth is labeled whatever its histograms say,
+ * so it is compressed without any.
+ */
+bool DecisionTree::needs_histogram(TreeNode *node)
+{
+    return max_depth == -1 || node->depth < max_depth;
+}
+
+/*
+ * This function initialize the histogram for each unlabeled leaf node
+ * that may be split. The others keep histogram_id -1.
+ * A leaf gets the histograms of a feature as it first sees it; the
+ * histograms of the previous level went back to the pool as its leaves
+ * were labeled or split.
  */
 void DecisionTree::init_histogram(vector<TreeNode *> &unlabeled_leaf)
 {
@@ -375,8 +398,9 @@ void DecisionTree::init_histogram(vector<TreeNode *> &unlabeled_leaf)
     assert(unlabeled_leaf.size() <= max_num_leaves);
     
     for (auto &p : unlabeled_leaf)
-        p->histogram_id = c++;
+        p->histogram_id = needs_histogram(p) ? c++ : -1;
 
     num_unlabled_leaves = c;
-    memset(histogram, 0, SIZE * sizeof(float));
+    long long zeroed = acquire_histograms(num_unlabled_leaves);
+    dbg_printf("HISTOGRAM leaves: %d/%d zeroed: %lld bytes\n", c, (int) unlabeled_leaf.size(), zeroed);
 }
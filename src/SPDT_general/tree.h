@@ -5,6 +5,7 @@
 #include <string.h>
 #include "parser.h"
 #include "array.h"
+#include "feature_map.h"
 #include <queue>
 #include <algorithm>
 #include <omp.h>
@@ -39,6 +40,8 @@ extern int num_of_features;
 extern int num_of_classes;
 extern int max_bin_size;
 extern int max_num_leaves;
+// set with -t: the node-parallel trainer shares max_num_leaves between subtrees
+extern bool use_leaf_budget;
 extern int NUM_OF_THREAD;
 
 extern long long SIZE;
@@ -51,6 +54,7 @@ public:
 	double entropy;
     SplitPoint();
     SplitPoint(int feature_id, float feature_value);
+    SplitPoint(const SplitPoint& split) = default;
     bool decision_rule(Data& data);
     inline SplitPoint& operator = (const SplitPoint& split){
         this->feature_id = split.feature_id;
@@ -104,6 +108,8 @@ private:
     // histogram size (num_leaf, num_feature, num_class)    
 
 public:
+    // dense feature ids of the training set with -r, see feature_map.h
+    FeatureMap feature_map;
 
     DecisionTree();
     ~DecisionTree();
@@ -132,11 +138,16 @@ public:
     void batch_initialize(TreeNode* node);
     void initialize(Dataset &train_data, const int batch_size);
     void init_histogram(vector<TreeNode* >& unlabled_leaf);
+    bool needs_histogram(TreeNode* node);
     TreeNode* navigate(Data& d);
     bool is_terminated(TreeNode* node);
+    // give the model and the training rows their raw feature ids back (-r)
+    void restore_raw_features(Dataset& train_data);
+    // node-parallel trainer: grow the subtree of a leaf in tasks, with at most
+    // `max_leaves` leaves if use_leaf_budget
+    void grow(TreeNode* node, int max_leaves);
 };
 
 
 
-void get_gain(TreeNode* node, SplitPoint& split, int feature_id);
 void prefix_printf(const char* format, ...);
\ No newline at end of file
@@ -7,6 +7,8 @@
 #include <math.h>
 #include <omp.h>
 #include "../SPDT_general/array.h"
+#include "../SPDT_general/compress.h"
+#include "../SPDT_general/gain.h"
 #include "../SPDT_general/timing.h"
 
 
@@ -24,6 +26,8 @@ void prefix_printf(const char* format, ...){
  */
 void TreeNode::split(SplitPoint &best_split, TreeNode* left, TreeNode* right)
 {
+    release_histogram(this->histogram_id);
+    this->histogram_id = -1;
     this->split_ptr = best_split;
     this->entropy = best_split.entropy;
     float split_value = best_split.feature_value;
@@ -50,68 +54,61 @@ void TreeNode::split(SplitPoint &best_split, TreeNode* left, TreeNode* right)
 }
 
 /*
- * This function return the best split point at a given leaf node.
- * Best split is store in `split`
+ * This function compress the data into histograms.
+ * The rows of every leaf are split evenly over the threads, so that even a
+ * single leaf (the root) keeps all of them busy. Thread t fills private
+ * histograms with the ids of the leaves shifted by t * num_unlabled_leaves
+ * (thread 0 uses the leaves' own). These are combined pairwise in
+ * log2(threads) rounds, always merging thread t + s into thread t, so the
+ * result only depends on the number of threads; a copy goes back to the pool
+ * as soon as it is merged. The zeros are added to the combined histograms
+ * only.
 */
-void DecisionTree::find_best_split(TreeNode *node, SplitPoint &split)
-{    
-    float* buf_merge = new float[2 * max_bin_size + 1];
-    SplitPoint* results = new SplitPoint[NUM_OF_THREAD];
-    for (int j = 0; j<NUM_OF_THREAD; j++)
-        results[j] = SplitPoint();
+void DecisionTree::compress(vector<Data> &data, vector<TreeNode*>& unlabeld)
+{
+    int num_threads = omp_get_max_threads();
+    int num_leaves = num_unlabled_leaves;
+    reserve_histograms(num_leaves * num_threads);
+    reset_sparse(num_leaves * num_threads);
+    for (auto cur : unlabeld)
+        cur->data_size = cur->data_ptr.size();
 
-    int tot = 0; // used to count the number of results
-    for (int i = 0; i < num_of_features; i++)
+    #pragma omp parallel
     {
         int tid = omp_get_thread_num();
-        // merge different labels
-        float* histo_for_class_0 = get_histogram_array(node->histogram_id, i, 0);
-        float* histo_for_class_1 = get_histogram_array(node->histogram_id, i, 1);
-        memcpy(buf_merge, histo_for_class_0, sizeof(float) * (2 * max_bin_size + 1));
-        std::vector<float> possible_splits;
-        merge_array_pointers(buf_merge, histo_for_class_1);
-        uniform_array(possible_splits, node->histogram_id, i, 0, buf_merge);
-        for (int j=0; j<possible_splits.size(); j++)
-        {
-            SplitPoint t = SplitPoint(i, possible_splits[j]);
-            get_gain(node, t, i);
-            if (t.gain > results[tid].gain)
-                results[tid] = t;
+        int T = omp_get_num_threads();
+        int base = tid * num_leaves;
+        // init_histogram acquired the leaves' own histograms
+        if (tid > 0) {
+            for (int j = 0; j < num_leaves; j++)
+                acquire_histogram(base + j);
         }
-    }
-
-    SplitPoint best_split;
-    best_split = results[0];
-    for(int ii=0; ii<NUM_OF_THREAD; ii++){
-        if (results[ii].gain > best_split.gain)
-            best_split = results[ii];
-    }
-
-    split.feature_id = best_split.feature_id;
-    split.feature_value = best_split.feature_value;
-    split.gain = best_split.gain;
-    delete[] buf_merge;
-    delete[] results;
-}
-
-
-/*
- * This function compress the data into histograms.
- * Each unlabeled leaf would have a (num_feature, num_class) histograms
- * This function takes the assumption that each leaf is re-initialized (we use a batch mode)
-*/
-void DecisionTree::compress(vector<Data> &data, vector<TreeNode*>& unlabeld)
-{
-    int feature_id = 0, class_id = 0;
-    // Construct the histogram. and navigate each data to its leaf.
-    #pragma omp parallel for schedule(dynamic)
-    for(int i=0; i<unlabeld.size(); i++){
-        auto cur = unlabeld[i];
-        for(auto& point: cur->data_ptr){
-            for (int attr = 0; attr < num_of_features; attr++)
-                update_array(cur->histogram_id, attr, point->label, point->get_value(attr));   
+        for (auto cur : unlabeld) {
+            if (cur->histogram_id < 0)
+                continue;
+            long long n = cur->data_ptr.size();
+            long long first = n * tid / T, last = n * (tid + 1) / T;
+            for (long long k = first; k < last; k++)
+                update_sparse(base + cur->histogram_id, *cur->data_ptr[k]);
         }
-        cur->data_size = cur->data_ptr.size();
+        for (int j = 0; j < num_leaves; j++)
+            flush_sparse(base + j);
+        for (int s = 1; s < T; s *= 2) {
+            #pragma omp barrier
+            if (tid % (2 * s) == 0 && tid + s < T) {
+                for (int j = 0; j < num_leaves; j++) {
+                    int src = base + s * num_leaves + j;
+                    gather_sparse(base + j, &src, 1);
+                    for (int attr : histogram_leaves[src].features)
+                        merge_sparse(base + j, &src, 1, attr);
+                    release_histogram(src);
+                }
+            }
+        }
+        #pragma omp barrier
+        #pragma omp for schedule(dynamic)
+        for (int j = 0; j < num_leaves; j++)
+            finish_sparse(j);
     }
 }
 
@@ -150,20 +147,28 @@ void DecisionTree::train_on_batch(Dataset &train_data)
         t1.reset();
         compress(train_data.dataset, unlabeled_leaf); 
         COMPRESS_TIME += t1.elapsed();
-        for (auto &cur_leaf : unlabeled_leaf)
+        // the leaves that may still split, searched all at once; a leaf
+        // terminated now stays terminated as the loop below labels others
+        vector<TreeNode *> searched(unlabeled_leaf.size(), NULL);
+        for (int i = 0; i < (int) unlabeled_leaf.size(); i++)
+            if (!is_terminated(unlabeled_leaf[i]))
+                searched[i] = unlabeled_leaf[i];
+        vector<SplitPoint> best_splits;
+        Timer t2 = Timer();
+        t2.reset();
+        best_splits_of_leaves(searched, best_splits);
+        SPLIT_TIME += t2.elapsed();
+        for (int i = 0; i < (int) unlabeled_leaf.size(); i++)
         {            
-            if (is_terminated(cur_leaf))
+            TreeNode *cur_leaf = unlabeled_leaf[i];
+            if (searched[i] == NULL || is_terminated(cur_leaf))
             {         
                 cur_leaf->set_label();
                 this->num_leaves++;             
             }
             else
             {                
-                SplitPoint best_split = SplitPoint();
-                Timer t2 = Timer();
-                t2.reset();
-                find_best_split(cur_leaf, best_split);
-                SPLIT_TIME += t2.elapsed();
+                SplitPoint best_split = best_splits[i];
                 dbg_ensures(best_split.gain >= -EPS);
                 if (best_split.gain <= min_gain){
                     dbg_printf("Node terminated: gain=%.4f <= %.4f\n", best_split.gain, min_gain);
@@ -9,6 +9,8 @@
 #include <omp.h>
 
 #include "../SPDT_general/array.h"
+#include "../SPDT_general/compress.h"
+#include "../SPDT_general/gain.h"
 #include "../SPDT_general/timing.h"
 
 void prefix_printf(const char* format, ...){
@@ -25,6 +27,8 @@ void prefix_printf(const char* format, ...){
  */
 void TreeNode::split(SplitPoint &best_split, TreeNode* left, TreeNode* right)
 {
+    release_histogram(this->histogram_id);
+    this->histogram_id = -1;
     this->split_ptr = best_split;
     this->entropy = best_split.entropy;
     float split_value = best_split.feature_value;
@@ -50,59 +54,6 @@ void TreeNode::split(SplitPoint &best_split, TreeNode* left, TreeNode* right)
     dbg_assert(left->num_pos_label + right->num_pos_label == this->num_pos_label);
 }
 
-/*
- * This function return the best split point at a given leaf node.
- * Best split is store in `split`
-*/
-void DecisionTree::find_best_split(TreeNode *node, SplitPoint &split)
-{    
-    float** buf_merge = (float**) malloc(NUM_OF_THREAD * sizeof(float*));
-    for (int k=0; k<NUM_OF_THREAD; k++)
-        buf_merge[k] = (float*) malloc(sizeof(float) * (2 * max_bin_size + 1));
-
-    SplitPoint* results = new SplitPoint[NUM_OF_THREAD];
-    for (int j = 0; j<NUM_OF_THREAD; j++)
-        results[j] = SplitPoint();
-
-    int tot = 0; // used to count the number of results
-    #pragma barrier
-    #pragma omp parallel for schedule(dynamic)
-    for (int i = 0; i < num_of_features; i++)
-    {
-        int tid = omp_get_thread_num();
-        // merge different labels
-        float* histo_for_class_0 = get_histogram_array(node->histogram_id, i, 0);
-        float* histo_for_class_1 = get_histogram_array(node->histogram_id, i, 1);
-        memcpy(buf_merge[tid], histo_for_class_0, sizeof(float) * (2 * max_bin_size + 1));
-        std::vector<float> possible_splits;
-        merge_array_pointers(buf_merge[tid], histo_for_class_1);
-        uniform_array(possible_splits, node->histogram_id, i, 0, buf_merge[tid]);
-        for (int j=0; j<possible_splits.size(); j++)
-        {
-            SplitPoint t = SplitPoint(i, possible_splits[j]);
-            get_gain(node, t, i);
-            if (t.gain > results[tid].gain)
-                results[tid] = t;
-        }
-    }
-
-    SplitPoint best_split;
-    best_split = results[0];
-    for(int ii=0; ii < NUM_OF_THREAD; ii++){
-        if (results[ii].gain > best_split.gain)
-            best_split = results[ii];
-    }
-
-    split.feature_id = best_split.feature_id;
-    split.feature_value = best_split.feature_value;
-    split.gain = best_split.gain;
-    delete[] results;
-    for (int k=0; k<NUM_OF_THREAD; k++)
-        free(buf_merge[k]);
-    free(buf_merge);
-}
-
-
 /*
  * This function compress the data into histograms.
  * Each unlabeled leaf would have a (num_feature, num_class) histograms
@@ -112,14 +63,16 @@ void DecisionTree::compress(vector<Data> &data, vector<TreeNode*>& unlabeld)
 {
     int feature_id = 0, class_id = 0;
     // Construct the histogram. and navigate each data to its leaf.
+    reset_sparse(num_unlabled_leaves);
     #pragma omp parallel for schedule(dynamic)
     for(int i=0; i<unlabeld.size(); i++){
         auto cur = unlabeld[i];
-        for(auto& point: cur->data_ptr){
-            for (int attr = 0; attr < num_of_features; attr++)
-                update_array(cur->histogram_id, attr, point->label, point->get_value(attr));   
-        }
         cur->data_size = cur->data_ptr.size();
+        if (cur->histogram_id < 0)
+            continue;
+        for(auto& point: cur->data_ptr)
+            update_sparse(cur->histogram_id, *point);
+        finish_sparse(cur->histogram_id);
     }
 }
 
@@ -157,20 +110,28 @@ void DecisionTree::train_on_batch(Dataset &train_data)
         t1.reset();
         compress(train_data.dataset, unlabeled_leaf); 
         COMPRESS_TIME += t1.elapsed();
-        for (auto &cur_leaf : unlabeled_leaf)
+        // the leaves that may still split, searched all at once; a leaf
+        // terminated now stays terminated as the loop below labels others
+        vector<TreeNode *> searched(unlabeled_leaf.size(), NULL);
+        for (int i = 0; i < (int) unlabeled_leaf.size(); i++)
+            if (!is_terminated(unlabeled_leaf[i]))
+                searched[i] = unlabeled_leaf[i];
+        vector<SplitPoint> best_splits;
+        Timer t2 = Timer();
+        t2.reset();
+        best_splits_of_leaves(searched, best_splits);
+        SPLIT_TIME += t2.elapsed();
+        for (int i = 0; i < (int) unlabeled_leaf.size(); i++)
         {            
-            if (is_terminated(cur_leaf))
+            TreeNode *cur_leaf = unlabeled_leaf[i];
+            if (searched[i] == NULL || is_terminated(cur_leaf))
             {         
                 cur_leaf->set_label();
                 this->num_leaves++;             
             }
             else
             {                
-                SplitPoint best_split = SplitPoint();
-                Timer t2 = Timer();
-                t2.reset();
-                find_best_split(cur_leaf, best_split);
-                SPLIT_TIME += t2.elapsed();
+                SplitPoint best_split = best_splits[i];
                 dbg_ensures(best_split.gain >= -EPS);
                 if (best_split.gain <= min_gain){
                     dbg_printf("Node terminated: gain=%.4f <= %.4f\n", best_split.gain, min_gain);
@@ -6,9 +6,29 @@
 #include <algorithm>
 #include <math.h>
 #include "../SPDT_general/array.h"
+#include "../SPDT_general/compress.h"
+#include "../SPDT_general/gain.h"
 #include "../SPDT_general/timing.h"
 
-#define NUM_OF_THREADS 8
+/*
+ * Node-parallel training. Every leaf that is split hands its children to
+ * tasks of their own, which compress their rows and search their split in
+ * the histograms of the thread that runs them. The tasks go to the task pool
+ * of the OpenMP runtime rather than to a hand-written work-stealing deque:
+ * idle threads take the pending tasks, so an unbalanced tree keeps them busy
+ * without a barrier per level. A leaf with fewer rows than
+ * NODE_TASK_MIN_ROWS grows its subtree in the task it is in.
+ *
+ * As in the other trainers, a leaf stops splitting once max_num_leaves
+ * leaves are labeled, so which leaves reach the cap depends on the order the
+ * tasks run in. With -t (use_leaf_budget) a split shares the leaves its
+ * subtree may still have between the children by their rows instead, and
+ * the tree is the same for any thread count.
+ */
+#define NODE_TASK_MIN_ROWS 2048
+
+// time the tasks spent compressing and searching splits, summed over threads
+static double compress_busy, split_busy;
 
 void prefix_printf(const char* format, ...){
     va_list args;
@@ -24,6 +44,8 @@ void prefix_printf(const char* format, ...){
  */
 void TreeNode::split(SplitPoint &best_split, TreeNode* left, TreeNode* right)
 {
+    release_histogram(this->histogram_id);
+    this->histogram_id = -1;
     this->split_ptr = best_split;
     this->entropy = best_split.entropy;
     float split_value = best_split.feature_value;
@@ -55,67 +77,100 @@ void TreeNode::split(SplitPoint &best_split, TreeNode* left, TreeNode* right)
 */
 void DecisionTree::find_best_split(TreeNode *node, SplitPoint &split)
 {    
-    float* buf_merge = new float[2 * max_bin_size + 1];
-    SplitPoint results[NUM_OF_THREADS];
-    for (int j = 0; j<NUM_OF_THREADS; j++)
-        results[j] = SplitPoint();
-
-    int tot = 0; // used to count the number of results
-    for (int i = 0; i < num_of_features; i++)
-    {
-        int tid = omp_get_thread_num();
-        // merge different labels
-        float* histo_for_class_0 = get_histogram_array(node->histogram_id, i, 0);
-        float* histo_for_class_1 = get_histogram_array(node->histogram_id, i, 1);
-        memcpy(buf_merge, histo_for_class_0, sizeof(float) * (2 * max_bin_size + 1));
-        std::vector<float> possible_splits;
-        merge_array_pointers(buf_merge, histo_for_class_1);
-        uniform_array(possible_splits, node->histogram_id, i, 0, buf_merge);
-        for (int j=0; j<possible_splits.size(); j++)
-        {
-            SplitPoint t = SplitPoint(i, possible_splits[j]);
-            get_gain(node, t, i);
-            if (t.gain > results[tid].gain)
-                results[tid] = t;
-        }
-    }
-
-    SplitPoint best_split;
-    best_split = results[0];
-    for(int ii=0; ii<NUM_OF_THREADS; ii++){
-        if (results[ii].gain > best_split.gain)
-            best_split = results[ii];
-    }
+    SplitPoint best_split = SplitPoint();
+    // only the features the leaf has seen, see LeafHistograms
+    for (int i : histogram_leaves[node->histogram_id].features)
+        best_split_of_feature(node, i, best_split);
 
     split.feature_id = best_split.feature_id;
     split.feature_value = best_split.feature_value;
     split.gain = best_split.gain;
-    delete[] buf_merge;
 }
 
 
 /*
- * This function compress the data into histograms.
- * Each unlabeled leaf would have a (num_feature, num_class) histograms
- * This function takes the assumption that each leaf is re-initialized (we use a batch mode)
-*/
-void DecisionTree::compress(vector<Data> &data, vector<TreeNode*>& unlabeld)
+ * Compress the rows of a leaf into histogram `histogram_id`.
+ * Leaves of different threads are compressed at the same time.
+ */
+static void compress_leaf(TreeNode *node, int histogram_id)
 {
-    int feature_id = 0, class_id = 0;
-    // Construct the histogram. and navigate each data to its leaf.
-    for(int i=0; i<unlabeld.size(); i++){
-        auto cur = unlabeld[i];
-        for(auto& point: cur->data_ptr){
-            for (int attr = 0; attr < num_of_features; attr++)
-                update_array(cur->histogram_id, attr, point->label, point->get_value(attr));   
-        }
-        cur->data_size = cur->data_ptr.size();
+    node->histogram_id = histogram_id;
+    acquire_histogram(histogram_id);
+    fill(leaf_rows.begin() + histogram_id * num_of_classes,
+        leaf_rows.begin() + (histogram_id + 1) * num_of_classes, 0);
+    for (auto &point : node->data_ptr)
+        update_sparse(histogram_id, *point);
+    finish_sparse(histogram_id);
+}
+
+/*
+ * Split `node` or label it, then grow its children. With use_leaf_budget the
+ * subtree gets at most `max_leaves` leaves, shared between the children by
+ * their rows.
+ * The histograms of the calling thread are released before the children
+ * are spawned, as the thread may run one of them right away.
+ */
+void DecisionTree::grow(TreeNode *node, int max_leaves)
+{
+    node->data_size = node->data_ptr.size();
+    if ((use_leaf_budget && max_leaves < 2) || is_terminated(node))
+    {
+        node->set_label();
+        #pragma omp atomic
+        this->num_leaves++;
+        return;
+    }
+    Timer t1 = Timer();
+    t1.reset();
+    compress_leaf(node, omp_get_thread_num());
+    #pragma omp atomic
+    compress_busy += t1.elapsed();
+
+    SplitPoint best_split = SplitPoint();
+    Timer t2 = Timer();
+    t2.reset();
+    find_best_split(node, best_split);
+    #pragma omp atomic
+    split_busy += t2.elapsed();
+    dbg_ensures(best_split.gain >= -EPS);
+    if (best_split.gain <= min_gain)
+    {
+        dbg_printf("Node terminated: gain=%.4f <= %.4f\n", best_split.gain, min_gain);
+        node->set_label();
+        #pragma omp atomic
+        this->num_leaves++;
+        return;
+    }
+    int id;
+    #pragma omp critical(tree_shape)
+    {
+        id = this->num_nodes;
+        this->num_nodes += 2;
+        this->cur_depth = max(this->cur_depth, node->depth + 1);
+    }
+    TreeNode *left = node->left_node = new TreeNode(node->depth + 1, id);
+    TreeNode *right = node->right_node = new TreeNode(node->depth + 1, id + 1);
+    node->split(best_split, left, right);
+    node->is_leaf = false;
+    node->label = -1;
+
+    int left_leaves = (long long) max_leaves * left->data_ptr.size() / node->data_size;
+    left_leaves = min(max(left_leaves, 1), max_leaves - 1);
+    int right_leaves = max_leaves - left_leaves;
+    if (node->data_size < NODE_TASK_MIN_ROWS)
+    {
+        grow(left, left_leaves);
+        grow(right, right_leaves);
+        return;
     }
+    #pragma omp task
+    grow(left, left_leaves);
+    grow(right, right_leaves);
 }
 
 
 /*
- * Serial version of training.
+ * Node-parallel version of training.
 */
 void DecisionTree::train_on_batch(Dataset &train_data)
 {
@@ -130,61 +185,31 @@ void DecisionTree::train_on_batch(Dataset &train_data)
     batch_initialize(root); // Reinitialize every leaf in T as unlabeled.
     vector<TreeNode *> unlabeled_leaf = __get_unlabeled(root);
     dbg_assert(unlabeled_leaf.size() <= max_num_leaves);
-    while (!unlabeled_leaf.empty())
-    {        
-        // each while loop would add a new level node.
-        this->cur_depth++;
-        printf("depth [%d] finished\n", this->cur_depth);
-        vector<TreeNode *> unlabeled_leaf_new; 
-        if (unlabeled_leaf.size() > max_num_leaves) {
-            for (int i = 0; i < unlabeled_leaf.size(); i++) {
-                unlabeled_leaf[i]->set_label();
-                this->num_leaves++;
-            }
-            break;
-        }       
-        init_histogram(unlabeled_leaf); 
-        compress(train_data.dataset, unlabeled_leaf); 
-        int siz = unlabeled_leaf.size();
-        #pragma omp parallel for
-        for (int e=0; e < siz; e++)
-        {        
-            auto& cur_leaf = unlabeled_leaf[e];    
-            if (is_terminated(cur_leaf))
-            {         
-                cur_leaf->set_label();
-                #pragma omp atomic
-                    this->num_leaves++;
-            }
-            else
-            {                
-                SplitPoint best_split = SplitPoint();
-                find_best_split(cur_leaf, best_split);
-                dbg_ensures(best_split.gain >= -EPS);
-                if (best_split.gain <= min_gain){
-                    dbg_printf("Node terminated: gain=%.4f <= %.4f\n", best_split.gain, min_gain);
-                    cur_leaf->set_label();
-                    #pragma omp atomic
-                    this->num_leaves++; 
-                    continue;
-                }
-                cur_leaf->left_node = new TreeNode(this->cur_depth, this->num_nodes++);
-                cur_leaf->right_node = new TreeNode(this->cur_depth, this->num_nodes++);
-                cur_leaf->split(best_split, cur_leaf->left_node, cur_leaf->right_node);
-                cur_leaf->is_leaf = false;
-                cur_leaf->label = -1;
-                #pragma omp critical
-                {
-                    unlabeled_leaf_new.push_back(cur_leaf->left_node);
-                    unlabeled_leaf_new.push_back(cur_leaf->right_node);
-                }
-
-            }
+    // a task holds the histograms of its thread only while it runs
+    int num_threads = omp_get_max_threads();
+    reserve_histograms(num_threads);
+    reset_sparse(num_threads);
+    int max_leaves = max_num_leaves / (int) unlabeled_leaf.size();
+    compress_busy = split_busy = 0;
+    Timer t = Timer();
+    t.reset();
+    #pragma omp parallel
+    #pragma omp single
+    {
+        for (auto &cur_leaf : unlabeled_leaf)
+        {
+            #pragma omp task
+            grow(cur_leaf, max_leaves);
         }
-        #pragma omp barrier
-        unlabeled_leaf = unlabeled_leaf_new;
-        unlabeled_leaf_new.clear(); 
     }
+    // the wall time of the tasks, shared by the time each phase kept them busy
+    double elapsed = t.elapsed();
+    double busy = compress_busy + split_busy;
+    if (busy > 0)
+    {
+        COMPRESS_TIME += elapsed * compress_busy / busy;
+        SPLIT_TIME += elapsed * split_busy / busy;
+    }
+    prefix_printf("TREE depth: %d leaves: %d nodes: %d\n", this->cur_depth, this->num_leaves, this->num_nodes);
     self_check();    
 }
-
@@ -2,8 +2,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <thread>
 #include "mpi.h"
 #include "../SPDT_general/tree.h"
+#include "../SPDT_general/binning.h"
+#include "../SPDT_general/gain.h"
 #include "../SPDT_general/timing.h"
 
 
@@ -12,6 +15,8 @@ vector<string> names = {"a1a", "ijcnn1", "avazu-app", "rcv1", "covtype", "genera
                         "middle_size_middle_feature", "middle_size_big_feature", // testing feature parallel
                         "middle_size_middle2_feature",
                         };
+// threads each rank parses its shard with
+int NUM_OF_THREAD = 1;
 
 vector<int> trainSize = {1605, 49990, 40428967, 20242, 581012, 40000,
                         990000, 99000, 9900, 990,
@@ -26,7 +31,7 @@ vector<int> featureNum = {123, 22, 1000000, 47236, 54, 300,
                           200, 1000,
                           400};
 string help_msg = "-l: max_num_leaf.\n-d: max_depth.\n-n: number of"\
-                  "threads.\n-b: max_bin_size\n-l: max_num_leaf\n-e: min_node_size\n";
+                  "threads.\n-q: pre-quantize the features\n-r: renumber the used features densely\n-g: gain kernel (0 scalar, 1 sse4.2, 2 avx2, 3 avx-512)\n-b: max_bin_size\n-l: max_num_leaf\n-e: min_node_size\n";
 
 int main(int argc, char *argv[]) {
     MPI_Init(&argc, &argv);
@@ -40,19 +45,32 @@ int main(int argc, char *argv[]) {
     int num_of_thread = -1;    
     int min_node_size = -1;
     int max_depth = -1;
-    int thread_num = 1;
-    while((c = getopt(argc, argv, "i:")) != -1 ){
+    while((c = getopt(argc, argv, "i:n:qg:r")) != -1 ){
         switch (c)
         {
         case 'i':
             index = (int)std::atoi(optarg);            
+            break;
+        case 'n':
+            num_of_thread = (int)std::atoi(optarg);
+            break;
+        case 'q':
+            use_binning = true;
+            break;
+        case 'r':
+            use_feature_map = true;
+            break;
+        case 'g':
+            gain_isa = (int)std::atoi(optarg);
             break;        
         default:
             break;
         }
     }
     
-    num_of_thread = (num_of_thread == -1)? 8 : num_of_thread;
+    // by default the ranks share the cores of the machine
+    int cores = (int)std::thread::hardware_concurrency();
+    NUM_OF_THREAD = (num_of_thread == -1) ? std::max(1, cores / numtasks) : num_of_thread;
     max_num_leaves = (max_num_leaves == -1) ? 64 : max_num_leaves;
     max_depth = (max_depth == -1) ? 9 : max_depth;
     min_node_size = (min_node_size == -1) ? 32 : min_node_size;
@@ -65,8 +83,10 @@ int main(int argc, char *argv[]) {
     prefix_printf("SIZE: (%d, %d) \n", trainSize[index], num_of_features);
     prefix_printf("NUM_WORKERS: %d\n", numtasks);
     DecisionTree decisionTree(max_depth, min_node_size);
+    // every rank parses only its own shard of the rows
     Dataset trainDataset(trainSize[index]);
-    trainDataset.open_read_data(trainName);
+    trainDataset.open_shard(trainName, taskid, numtasks);
+    prefix_printf("SHARD_SIZE: %d\n", trainDataset.num_of_data);
     Timer t = Timer();
     t.reset();
     decisionTree.train(trainDataset, trainSize[index]);
@@ -75,13 +95,15 @@ int main(int argc, char *argv[]) {
     // test
     string testName = "./data/" + names[index] + ".test.txt";
     Dataset testDataset(testSize[index]);
-    testDataset.open_read_data(testName);	
+    testDataset.open_shard(testName, taskid, numtasks);	
     prefix_printf("COMPRESS_TIME: %f\n", COMPRESS_TIME); 
     prefix_printf("NET_COMPRESS_TIME: %f\n", COMPRESS_TIME - COMPRESS_COMMUNICATION_TIME); 
     prefix_printf("SPLIT_TIME: %f\n", SPLIT_TIME); 
     prefix_printf("NET_SPLIT_TIME: %f\n", SPLIT_TIME - SPLIT_COMMUNICATION_TIME); 
     prefix_printf("COMPRESS_COMMUNICATION_Time: %f\n", COMPRESS_COMMUNICATION_TIME);
     prefix_printf("SPLIT_COMMUNICATION_Time: %f\n", SPLIT_COMMUNICATION_TIME);
+    prefix_printf("HISTOGRAM_PEAK_MB: %f\n", histogram_pool_stats.peak_bytes / 1024.f / 1024.f);
+    prefix_printf("HISTOGRAM_ZEROED_MB: %f\n", histogram_pool_stats.zeroed_bytes / 1024.f / 1024.f);
     prefix_printf("Train_Time: %f\n", cpu_time_used_train);
     prefix_printf("Training_Correct_Rate: %f\n", decisionTree.test(trainDataset));
     t.reset();
@@ -7,6 +7,8 @@
 #include <math.h>
 #include "../SPDT_general/timing.h"
 #include "../SPDT_general/array.h"
+#include "../SPDT_general/compress.h"
+#include "../SPDT_general/gain.h"
 #include "mpi.h"
 #include "stdarg.h"
 
@@ -46,6 +48,8 @@ void prefix_printf(const char* format, ...){
  */
 void TreeNode::split(SplitPoint &best_split, TreeNode *left, TreeNode *right)
 {
+    release_histogram(this->histogram_id);
+    this->histogram_id = -1;
     this->split_ptr = best_split;
     this->entropy = best_split.entropy;
     float split_value = best_split.feature_value;
@@ -65,12 +69,13 @@ void TreeNode::split(SplitPoint &best_split, TreeNode *left, TreeNode *right)
             num_pos_lebel_left = (p->label == POS_LABEL) ? num_pos_lebel_left + 1 : num_pos_lebel_left;
         }
     }
+    // local counts of this rank, compress() sums them over all ranks
     left->num_pos_label = num_pos_lebel_left;
     right->num_pos_label = num_pos_lebel_right;
 
     dbg_assert(left->num_pos_label >= 0);
     dbg_assert(right->num_pos_label >= 0);
-    dbg_assert(left->num_pos_label + right->num_pos_label == this->num_pos_label);
+    dbg_assert(left->data_ptr.size() + right->data_ptr.size() == this->data_ptr.size());
 }
 
 
@@ -103,29 +108,11 @@ void DecisionTree::find_best_split(TreeNode *node, SplitPoint &split)
     MPI_Type_create_struct(nitems, blocklengths, offsets, types, &mpi_split_info);
     MPI_Type_commit(&mpi_split_info);
     MPI_split_info mpi_best;
-    float *buf_merge = new float[2 * max_bin_size + 1];
     SplitPoint best_split = SplitPoint();
-    for (int i = taskid; i < num_of_features; i+=numtasks)
-    {
-        // merge different labels
-        // put the result back into (node->histogram_id, i, 0)
-        float *histo_for_class_0 = get_histogram_array(node->histogram_id, i, 0);
-        float *histo_for_class_1 = get_histogram_array(node->histogram_id, i, 1);
-        memcpy(buf_merge, histo_for_class_0, sizeof(float) * (2 * max_bin_size + 1));
-        std::vector<float> possible_splits;
-        merge_array_pointers(buf_merge, histo_for_class_1);
-        // print_array(histo_for_class_0);
-        // print_array(histo_for_class_1);
-        uniform_array(possible_splits, node->histogram_id, i, 0, buf_merge);
-        dbg_assert(possible_splits.size() <= max_bin_size);
-        for (auto &split_value : possible_splits)
-        {
-            SplitPoint t = SplitPoint(i, split_value);
-            get_gain(node, t, i);
-            if (best_split.gain < t.gain)
-                best_split = t;
-        }
-    }
+    // only the features the leaf has seen, see LeafHistograms
+    const vector<int>& features = histogram_leaves[node->histogram_id].features;
+    for (int k = taskid; k < (int) features.size(); k += numtasks)
+        best_split_of_feature(node, features[k], best_split);
     mpi_best.feature_id = best_split.feature_id;
     mpi_best.feature_value = best_split.feature_value;
     mpi_best.gain = best_split.gain;
@@ -156,85 +143,184 @@ void DecisionTree::find_best_split(TreeNode *node, SplitPoint &split)
     best_split.entropy = mpi_best.entropy;
     best_split.gain = mpi_best.gain;
     split = best_split;
-    delete[] buf_merge;
     if (taskid == MASTER)
         delete[] candidates;
 }
 
-void DecisionTree::compress(vector<Data> &data)
+/*
+ * Byte buffers of any size over MPI: the length goes first as a long long,
+ * then the payload in pieces of MPI_CHUNK_BYTES, since MPI counts are int.
+ */
+#define MPI_CHUNK_BYTES (1 << 30)
+
+static void send_bytes(vector<char> &buffer, int dest)
+{
+    long long bytes = buffer.size();
+    MPI_Send(&bytes, 1, MPI_LONG_LONG, dest, 0, MPI_COMM_WORLD);
+    for (long long off = 0; off < bytes; off += MPI_CHUNK_BYTES)
+        MPI_Send(buffer.data() + off, (int) min<long long>(MPI_CHUNK_BYTES, bytes - off), MPI_BYTE, dest, 0, MPI_COMM_WORLD);
+}
+
+static void recv_bytes(vector<char> &buffer, int source)
+{
+    long long bytes;
+    MPI_Recv(&bytes, 1, MPI_LONG_LONG, source, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    buffer.resize(bytes);
+    for (long long off = 0; off < bytes; off += MPI_CHUNK_BYTES)
+        MPI_Recv(buffer.data() + off, (int) min<long long>(MPI_CHUNK_BYTES, bytes - off), MPI_BYTE, source, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+}
+
+static void bcast_bytes(vector<char> &buffer, int root)
+{
+    long long bytes = buffer.size();
+    MPI_Bcast(&bytes, 1, MPI_LONG_LONG, root, MPI_COMM_WORLD);
+    buffer.resize(bytes);
+    for (long long off = 0; off < bytes; off += MPI_CHUNK_BYTES)
+        MPI_Bcast(buffer.data() + off, (int) min<long long>(MPI_CHUNK_BYTES, bytes - off), MPI_BYTE, root, MPI_COMM_WORLD);
+}
+
+/* per leaf the int32 number of features it has seen, then their int32 ids */
+static void pack_features(int num_leaves, vector<char> &buffer)
+{
+    buffer.clear();
+    for (int j = 0; j < num_leaves; j++)
+    {
+        const vector<int> &features = histogram_leaves[j].features;
+        int32_t num_features = features.size();
+        buffer.insert(buffer.end(), (char *)&num_features, (char *)(&num_features + 1));
+        buffer.insert(buffer.end(), (char *)features.data(), (char *)(features.data() + num_features));
+    }
+}
+
+static void add_features(int num_leaves, const vector<char> &buffer)
+{
+    const char *in = buffer.data();
+    for (int j = 0; j < num_leaves; j++)
+    {
+        int32_t num_features, f;
+        memcpy(&num_features, in, sizeof(int32_t));
+        in += sizeof(int32_t);
+        for (int k = 0; k < num_features; k++, in += sizeof(int32_t))
+        {
+            memcpy(&f, in, sizeof(int32_t));
+            sparse_block(j, f);
+        }
+    }
+}
+
+/*
+ * Give the leaves of every rank all the features any rank has seen in them,
+ * so that each rank adds the zeros of its own rows to those features.
+ */
+static void share_features(int num_leaves, int taskid, int numtasks)
+{
+    vector<char> buffer;
+    if (taskid == MASTER)
+    {
+        for (int source = 1; source < numtasks; source++)
+        {
+            recv_bytes(buffer, source);
+            add_features(num_leaves, buffer);
+        }
+        pack_features(num_leaves, buffer);
+    }
+    else
+    {
+        pack_features(num_leaves, buffer);
+        send_bytes(buffer, MASTER);
+    }
+    bcast_bytes(buffer, MASTER);
+    if (taskid != MASTER)
+        add_features(num_leaves, buffer);
+}
+
+/*
+ * Every rank holds only its own shard of the data (see Dataset::open_shard),
+ * so each one compresses all of its rows. The master merges the histograms
+ * of all workers into its own in one pass and broadcasts the result; the
+ * leaf sizes and positive counts are summed over all ranks. The features of
+ * each leaf are shared before the zeros are added, as a rank may not see
+ * all of them.
+ */
+void DecisionTree::compress(vector<Data> &, vector<TreeNode *> &unlabeld)
 {
     int taskid, numtasks;
     MPI_Comm_rank(MPI_COMM_WORLD, &taskid);
     MPI_Comm_size(MPI_COMM_WORLD, &numtasks);
-    MPI_Request reqs;
-    MPI_Status status;
-    float *buffer;
-    float *buffer2;
-    int feature_id = 0, class_id = 0;
-    // Construct the histogram. and navigate each data to its leaf.
-    TreeNode *cur;
-    int tasks_per_worker = (data.size() + numtasks - 1) / numtasks;
-    for (int i = taskid * tasks_per_worker; i < (taskid + 1) * tasks_per_worker && i < data.size(); i++)
+    // local (data_size, num_pos_label) of every unlabeled leaf
+    vector<int> counts(2 * unlabeld.size());
+    reset_sparse(num_unlabled_leaves);
+    for (int i = 0; i < (int) unlabeld.size(); i++)
     {
-        auto &point = data[i];
-        cur = navigate(point);
-        if (cur->label > -1)
-            continue;
-
-        cur->data_size++;
-        for (int attr = 0; attr < num_of_features; attr++)
+        auto cur = unlabeld[i];
+        int num_pos = 0;
+        for (auto &point : cur->data_ptr)
         {
-            update_array(cur->histogram_id, attr, point.label, point.get_value(attr));
+            if (point->label == POS_LABEL)
+                num_pos++;
+            if (cur->histogram_id >= 0)
+                update_sparse(cur->histogram_id, *point);
         }
+        counts[2 * i] = cur->data_ptr.size();
+        counts[2 * i + 1] = num_pos;
     }
 
     Timer t = Timer();
     t.reset();
+    MPI_Allreduce(MPI_IN_PLACE, counts.data(), counts.size(), MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    COMPRESS_COMMUNICATION_TIME += t.elapsed();
+    for (int i = 0; i < (int) unlabeld.size(); i++)
+    {
+        unlabeld[i]->data_size = counts[2 * i];
+        unlabeld[i]->num_pos_label = counts[2 * i + 1];
+    }
+
+    t.reset();
+    share_features(num_unlabled_leaves, taskid, numtasks);
+    COMPRESS_COMMUNICATION_TIME += t.elapsed();
+    for (int j = 0; j < num_unlabled_leaves; j++)
+        finish_sparse(j);
+
+    // the histograms travel packed, see pack_histograms
+    vector<char> buffer;
     if (taskid == MASTER)
     {
-        buffer = new float[SIZE];
-        buffer2 = new float[SIZE];
-        int task_left = numtasks - 1;
-        while (task_left > 0)
+        vector<vector<char> > received(numtasks - 1);
+        vector<const char *> buffers;
+        for (int source = 1; source < numtasks; source++)
         {            
             t.reset();
-            MPI_Recv(buffer, SIZE, MPI_FLOAT, MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &status);
-            memcpy(buffer2, buffer, SIZE * sizeof(float));
-            for (int j = 0; j < num_unlabled_leaves; j++)
-            { // merge the results in the master thread
-                for (int k = 0; k < num_of_features; k++)
-                {
-                    for (int c = 0; c < num_of_classes; c++)
-                    {
-                        float *histo = get_histogram_array(j, k, c);
-                    }
-                }
-            }
+            recv_bytes(received[source - 1], source);
             COMPRESS_COMMUNICATION_TIME += t.elapsed();
-            task_left--;
+            buffers.push_back(received[source - 1].data());
         }
+        // merge all ranks at once in the master thread, in rank order
+        merge_packed_histograms(num_unlabled_leaves, buffers.data(), buffers.size());
+        pack_histograms(num_unlabled_leaves, buffer);
     }
     else
     {
+        pack_histograms(num_unlabled_leaves, buffer);
         t.reset();
-        MPI_Send(histogram, SIZE, MPI_FLOAT, MASTER, 0, MPI_COMM_WORLD);
+        send_bytes(buffer, MASTER);
         COMPRESS_COMMUNICATION_TIME += t.elapsed();
     }
     t.reset();
-    MPI_Bcast(histogram, SIZE, MPI_FLOAT, MASTER, MPI_COMM_WORLD);
+    bcast_bytes(buffer, MASTER);
     COMPRESS_COMMUNICATION_TIME += t.elapsed();   
-
-    if (taskid == MASTER) {
-        delete[] buffer;
-        delete[] buffer2;
-    } 
-
+    if (taskid != MASTER)
+        unpack_histograms(num_unlabled_leaves, buffer.data(), false);
+    // finish_sparse summed the local histograms only
+    for (int j = 0; j < num_unlabled_leaves; j++)
+        build_prefix_arrays(j);
 }
 
 SplitPoint::SplitPoint()
 {
     feature_id = -1;
     feature_value = 0;
+    // below any real candidate
+    gain = -1;
     entropy = 0;
 }
 
@@ -242,6 +328,7 @@ SplitPoint::SplitPoint(int feature_id, float feature_value)
 {
     this->feature_id = feature_id;
     this->feature_value = feature_value;
+    this->gain = -1;
     this->entropy = 0;
 }
 /*
@@ -288,8 +375,10 @@ void TreeNode::init()
  */
 void TreeNode::set_label()
 {
+    release_histogram(this->histogram_id);
+    this->histogram_id = -1;
     this->is_leaf = true;
-    this->label = (this->num_pos_label >= (int)this->data_ptr.size() / 2) ? POS_LABEL : NEG_LABEL;
+    this->label = (this->num_pos_label >= this->data_size / 2) ? POS_LABEL : NEG_LABEL;
 }
 
 void TreeNode::printspaces()
@@ -359,9 +448,9 @@ DecisionTree::~DecisionTree()
 */
 bool DecisionTree::is_terminated(TreeNode *node)
 {
-    if (min_node_size != -1 && node->data_ptr.size() <= min_node_size)
+    if (min_node_size != -1 && node->data_size <= min_node_size)
     {
-        dbg_printf("Node [%d] terminated: min_node_size=%d >= %d\n", node->id, min_node_size, node->data_ptr.size());
+        dbg_printf("Node [%d] terminated: min_node_size=%d >= %d\n", node->id, min_node_size, node->data_size);
         return true;
     }
 
@@ -376,13 +465,13 @@ bool DecisionTree::is_terminated(TreeNode *node)
         dbg_printf("Node [%d] terminated: max_num_leaves\n", node->id);
         return true;
     }
-    if (node->num_pos_label < EPS || node->num_pos_label == (int)node->data_ptr.size())
+    if (node->num_pos_label < EPS || node->num_pos_label == node->data_size)
     {
         dbg_assert(node->entropy < EPS);
         dbg_printf("Node [%d] terminated: all samples belong to same class\n", node->id);
         return true;
     }
-    dbg_printf("[%d] num_data=%d, num_pos=%d\n", node->id, node->data_ptr.size(), node->num_pos_label);
+    dbg_printf("[%d] num_data=%d, num_pos=%d\n", node->id, node->data_size, node->num_pos_label);
     return false;
 }
 
@@ -392,25 +481,59 @@ void DecisionTree::initialize(Dataset &train_data, const int batch_size)
     MPI_Comm_rank(MPI_COMM_WORLD, &taskid);
     this->datasetPointer = &train_data;
     root = new TreeNode(0, this->num_nodes++);
-    if (histogram != NULL)
-    {
-        delete[] histogram;
-    }
-    SIZE = (long long)max_num_leaves * num_of_features * num_of_classes * ((max_bin_size + 1) * 2 + 1);
+    SIZE = alloc_histograms(max_num_leaves);
     if (taskid == MASTER)
-        printf("MPI [%d] Init Root Node [%.4f] MB\n", taskid, SIZE * sizeof(float) / 1024.f / 1024.f);
-    
-    histogram = new float[SIZE];
-    memset(histogram, 0, SIZE * sizeof(float));
+        printf("MPI [%d] Init Root Node [%.4f] MB per leaf\n", taskid, SIZE / 1024.f / 1024.f);
 }
 
 void DecisionTree::train(Dataset &train_data, const int batch_size)
 {
+    int taskid;
+    MPI_Comm_rank(MPI_COMM_WORLD, &taskid);
     int hasNext = TRUE;
     initialize(train_data, batch_size);
+    if (use_feature_map)
+    {
+        // the used vectors of the ranks are reduced, so they need one size
+        int raw_features = train_data.raw_features();
+        MPI_Allreduce(MPI_IN_PLACE, &raw_features, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+        feature_map.reset(raw_features);
+    }
     while (TRUE)
     {
         hasNext = train_data.streaming_read_data(batch_size);
+        if (use_feature_map)
+        {
+            // every rank numbers the features used on any shard the same way
+            vector<char> used;
+            feature_map.mark_used(train_data.dataset, used);
+            MPI_Allreduce(MPI_IN_PLACE, used.data(), used.size(), MPI_BYTE, MPI_BOR, MPI_COMM_WORLD);
+            feature_map.extend(used);
+            feature_map.remap(train_data);
+            num_of_features = feature_map.size();
+        }
+        if (use_binning)
+        {
+            // cut points come from the first batch of rank 0's shard; with
+            // cut points of their own the ranks' bins would not line up
+            if (!feature_bins.ready())
+            {
+                vector<char> buffer;
+                if (taskid == MASTER)
+                {
+                    feature_bins.build(train_data.dataset, max_bin_size);
+                    feature_bins.pack(buffer);
+                }
+                bcast_bytes(buffer, MASTER);
+                if (taskid != MASTER)
+                    feature_bins.unpack(buffer);
+                // features first seen later would have no bins
+                feature_map.freeze();
+            }
+            feature_bins.quantize(train_data);
+        }
+        // shards may differ by a row, keep every rank in the loop until all are done
+        MPI_Allreduce(MPI_IN_PLACE, &hasNext, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
         dbg_printf("Train size (%d, %d, %d)\n", train_data.num_of_data,
                    num_of_features, num_of_classes);
         train_on_batch(train_data);
@@ -419,17 +542,44 @@ void DecisionTree::train(Dataset &train_data, const int batch_size)
     }
 
     train_data.close_read_data();
+    if (use_feature_map)
+        restore_raw_features(train_data);
     return;
 }
 
+/*
+ * Translate the splits of the trained tree from dense to raw feature ids,
+ * so the model can be applied to rows as they are read. The last training
+ * batch is still in memory and gets its raw ids back too.
+ */
+void DecisionTree::restore_raw_features(Dataset &train_data)
+{
+    queue<TreeNode *> q;
+    q.push(root);
+    while (!q.empty())
+    {
+        TreeNode *node = q.front();
+        q.pop();
+        if (node->is_leaf)
+            continue;
+        node->split_ptr.feature_id = feature_map.raw_id[node->split_ptr.feature_id];
+        q.push(node->left_node);
+        q.push(node->right_node);
+    }
+    feature_map.restore(train_data);
+    num_of_features = feature_map.raw_size();
+}
+
 double DecisionTree::test(Dataset &test_data)
 {
 
     int i = 0;
     int correct_num = 0;
-    test_data.streaming_read_data(test_data.num_of_data);
+    // the training set is still in memory after the last batch
+    if (test_data.already_read_data < test_data.num_of_data)
+        test_data.streaming_read_data(test_data.num_of_data);
 
-    for (i = 0; i < test_data.num_of_data; i++)
+    for (i = 0; i < (int) test_data.dataset.size(); i++)
     {
         assert(navigate(test_data.dataset[i])->label != -1);
         if (navigate(test_data.dataset[i])->label == test_data.dataset[i].label)
@@ -437,48 +587,10 @@ double DecisionTree::test(Dataset &test_data)
             correct_num++;
         }
     }
-    return (double)correct_num / (double)test_data.num_of_data;
-}
-
-/*
- * Calculate the entropy gain = H(Y) - H(Y|X)
- * H(Y|X) needs parameters p(X<a), p(Y=0|X<a), p(Y=0|X>=a)
- * Assuming binary classification problem
- */
-void get_gain(TreeNode *node, SplitPoint &split, int feature_id)
-{
-    int total_sum = node->data_ptr.size();
-    dbg_ensures(total_sum > 0);
-    double sum_class_0 = get_total_array(node->histogram_id, feature_id, NEG_LABEL);
-    double sum_class_1 = get_total_array(node->histogram_id, feature_id, POS_LABEL);
-    dbg_assert((sum_class_1 - node->num_pos_label) < EPS);
-    double left_sum_class_0 = sum_array(node->histogram_id, feature_id, NEG_LABEL, split.feature_value);
-    double right_sum_class_0 = sum_class_0 - left_sum_class_0;
-    double left_sum_class_1 = sum_array(node->histogram_id, feature_id, POS_LABEL, split.feature_value);
-    double right_sum_class_1 = sum_class_1 - left_sum_class_1;
-    double left_sum = left_sum_class_0 + left_sum_class_1;
-    double right_sum = right_sum_class_0 + right_sum_class_1;
-    double px = (left_sum_class_0 + left_sum_class_1) / (1.0 * total_sum);   // p(x<a)
-    double py_x0 = (left_sum <= EPS) ? 0.f : left_sum_class_0 / left_sum;    // p(y=0|x < a)
-    double py_x1 = (right_sum <= EPS) ? 0.f : right_sum_class_0 / right_sum; // p(y=0|x >= a)
-    dbg_ensures(py_x0 >= -EPS && py_x0 <= 1 + EPS);
-    dbg_ensures(py_x1 >= -EPS && py_x1 <= 1 + EPS);
-    dbg_ensures(px >= -EPS && px <= 1 + EPS);
-    double entropy_left = ((1 - py_x0) < EPS || py_x0 < EPS) ? 0 : -py_x0 * log2(py_x0) - (1 - py_x0) * log2(1 - py_x0);
-    double entropy_right = ((1 - py_x1) < EPS || py_x1 < EPS) ? 0 : -py_x1 * log2(py_x1) - (1 - py_x1) * log2(1 - py_x1);
-    double H_YX = px * entropy_left + (1 - px) * entropy_right;
-    double px_prior = sum_class_0 / (sum_class_0 + sum_class_1);
-    // prefix_printf("right_sum_class_0:%.7f = %.7f - %.7f\n", right_sum_class_0, sum_class_0, left_sum_class_0);
-    // prefix_printf("right_sum_class_1:%.7f = %.7f - %.7f\n", right_sum_class_1, sum_class_1, left_sum_class_1);
-    // prefix_printf("H_YX:%.7f = %.7f * %.7f - %.7f * %.7f\n", H_YX, px, entropy_left, 1-px, entropy_right);
-    // prefix_printf("entropy: px_prior = %.7f\n", px_prior);
-    // prefix_printf("entropy_left: px_prior = %.7f\n", py_x0);
-    // prefix_printf("entropy_right: px_prior = %.7f\n", py_x1);
-    // prefix_printf("%.7f = %.7f - %.7f\n", split.gain, split.entropy, H_YX);
-    dbg_ensures(px_prior >= 0 && px_prior <= 1); // buggy. inconsistency between data and histograms.
-    split.entropy = ((1 - px_prior) < EPS || px_prior < EPS) ? 0 : -px_prior * log2(px_prior) - (1 - px_prior) * log2(1 - px_prior);
-    split.gain = split.entropy - H_YX; 
-    // dbg_ensures(split.gain >= -EPS); // could be negative for some categorical features
+    // each rank holds one shard
+    int counts[2] = {correct_num, (int)test_data.dataset.size()};
+    MPI_Allreduce(MPI_IN_PLACE, counts, 2, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    return (double)counts[0] / (double)counts[1];
 }
 
 void DecisionTree::self_check()
@@ -590,8 +702,20 @@ TreeNode *DecisionTree::navigate(Data &d)
 }
 
 /*
- * This function initialize the histogram for each unlabeled leaf node.
- * Also, potentially, it would free the previous histogram.
+ * A leaf at max_depth is labeled whatever its histograms say,
+ * so it is compressed without any.
+ */
+bool DecisionTree::needs_histogram(TreeNode *node)
+{
+    return max_depth == -1 || node->depth < max_depth;
+}
+
+/*
+ * This function initialize the histogram for each unlabeled leaf node
+ * that may be split. The others keep histogram_id -1.
+ * A leaf gets the histograms of a feature as it first sees it; the
+ * histograms of the previous level went back to the pool as its leaves
+ * were labeled or split.
  */
 void DecisionTree::init_histogram(vector<TreeNode *> &unlabeled_leaf)
 {
@@ -599,10 +723,11 @@ void DecisionTree::init_histogram(vector<TreeNode *> &unlabeled_leaf)
     assert(unlabeled_leaf.size() <= max_num_leaves);
 
     for (auto &p : unlabeled_leaf)
-        p->histogram_id = c++;
+        p->histogram_id = needs_histogram(p) ? c++ : -1;
 
     num_unlabled_leaves = c;
-    memset(histogram, 0, SIZE * sizeof(float));
+    long long zeroed = acquire_histograms(num_unlabled_leaves);
+    dbg_printf("HISTOGRAM leaves: %d/%d zeroed: %lld bytes\n", c, (int) unlabeled_leaf.size(), zeroed);
 }
 
 /*
@@ -616,9 +741,11 @@ void DecisionTree::train_on_batch(Dataset &train_data)
     for (auto &data : train_data.dataset)
         root->data_ptr.push_back(&data);
 
-    float pos_rate = ((float)train_data.num_pos_label) / train_data.num_of_data;
+    int num_data[2] = {train_data.num_pos_label, train_data.num_of_data};
+    MPI_Allreduce(MPI_IN_PLACE, num_data, 2, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    float pos_rate = ((float)num_data[0]) / num_data[1];
     dbg_assert(pos_rate > 0 && pos_rate < 1);
-    root->num_pos_label = train_data.num_pos_label;
+    root->num_pos_label = num_data[0];
     root->entropy = -pos_rate * log2(pos_rate) - (1 - pos_rate) * log2((1 - pos_rate));
     batch_initialize(root); // Reinitialize every leaf in T as unlabeled.
     vector<TreeNode *> unlabeled_leaf = __get_unlabeled(root);
@@ -643,7 +770,7 @@ void DecisionTree::train_on_batch(Dataset &train_data)
         init_histogram(unlabeled_leaf);
         Timer t;
         t.reset();
-        compress(train_data.dataset);
+        compress(train_data.dataset, unlabeled_leaf);
         COMPRESS_TIME += t.elapsed();
         for (auto &cur_leaf : unlabeled_leaf)
         {
@@ -7,6 +7,7 @@
 #include <math.h>
 #include <time.h>
 #include "../SPDT_general/array.h"
+#include "../SPDT_general/gain.h"
 
 #include "mpi.h"
 
@@ -59,31 +60,23 @@ void DecisionTree::find_best_split(TreeNode *node, SplitPoint &split)
 {
     clock_t start, end;
     start = clock();       
-    float* buf_merge = new float[2 * max_bin_size + 1];
+    BinBuffer buf_merge(max_bin_size + 1);
     SplitPoint best_split = SplitPoint();
     for (int i = 0; i < num_of_features; i++)
     {
         // merge different labels
         // put the result back into (node->histogram_id, i, 0)
-        float* histo_for_class_0 = get_histogram_array(node->histogram_id, i, 0);
-        float* histo_for_class_1 = get_histogram_array(node->histogram_id, i, 1);
-        memcpy(buf_merge, histo_for_class_0, sizeof(float) * (2 * max_bin_size + 1));
+        BinArray histo_for_class[2] = {get_histogram_array(node->histogram_id, i, 0),
+                                       get_histogram_array(node->histogram_id, i, 1)};
         std::vector<float> possible_splits;
-        merge_array_pointers(buf_merge, histo_for_class_1);
-        uniform_array(possible_splits, node->histogram_id, i, 0, buf_merge);
+        merge_arrays(buf_merge.bins(), histo_for_class, 2);
+        uniform_array(possible_splits, node->histogram_id, i, 0, buf_merge.bins());
         dbg_assert(possible_splits.size() <= max_bin_size);
-        for (auto& split_value: possible_splits)
-        {
-            SplitPoint t = SplitPoint(i, split_value);
-            get_gain(node, t, i);
-            if (best_split.gain < t.gain)
-                best_split = t;
-        }
+        best_of_splits(node, i, possible_splits, best_split);
     }
     split = best_split;
     end = clock();   
     SPLIT_TIME += ((double) (end - start)) / CLOCKS_PER_SEC; 
-    delete[] buf_merge;
 }
 
 void DecisionTree::compress(vector<Data> &data)
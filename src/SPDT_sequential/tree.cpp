@@ -7,6 +7,8 @@
 #include <math.h>
 #include <time.h>
 #include "../SPDT_general/array.h"
+#include "../SPDT_general/compress.h"
+#include "../SPDT_general/gain.h"
 #include "../SPDT_general/timing.h"
 
 
@@ -24,6 +26,8 @@ void prefix_printf(const char* format, ...){
  */
 void TreeNode::split(SplitPoint &best_split, TreeNode* left, TreeNode* right)
 {
+    release_histogram(this->histogram_id);
+    this->histogram_id = -1;
     this->split_ptr = best_split;
     this->entropy = best_split.entropy;
     float split_value = best_split.feature_value;
@@ -58,31 +62,13 @@ void DecisionTree::find_best_split(TreeNode *node, SplitPoint &split)
 {
     clock_t start, end;
     start = clock();       
-    float* buf_merge = new float[2 * max_bin_size + 1];
     SplitPoint best_split = SplitPoint();
-    for (int i = 0; i < num_of_features; i++)
-    {
-        // merge different labels
-        // put the result back into (node->histogram_id, i, 0)
-        float* histo_for_class_0 = get_histogram_array(node->histogram_id, i, 0);
-        float* histo_for_class_1 = get_histogram_array(node->histogram_id, i, 1);
-        memcpy(buf_merge, histo_for_class_0, sizeof(float) * (2 * max_bin_size + 1));
-        std::vector<float> possible_splits;
-        merge_array_pointers(buf_merge, histo_for_class_1);
-        uniform_array(possible_splits, node->histogram_id, i, 0, buf_merge);
-        dbg_assert(possible_splits.size() <= max_bin_size);
-        for (auto& split_value: possible_splits)
-        {
-            SplitPoint t = SplitPoint(i, split_value);
-            get_gain(node, t, i);
-            if (best_split.gain < t.gain)
-                best_split = t;
-        }
-    }
+    // only the features the leaf has seen, see LeafHistograms
+    for (int i : histogram_leaves[node->histogram_id].features)
+        best_split_of_feature(node, i, best_split);
     split = best_split;
     end = clock();   
     // SPLIT_TIME += ((double) (end - start)) / CLOCKS_PER_SEC; 
-    delete[] buf_merge;
 }
 
 /*
@@ -96,14 +82,17 @@ void DecisionTree::compress(vector<Data> &data)
     // Construct the histogram. and navigate each data to its leaf.
     TreeNode* cur;
     int c=0;
+    reset_sparse(num_unlabled_leaves);
     for(auto& point : data){
         cur = navigate(point);
         if (cur->label > -1)
             continue;
         cur->data_size ++;
-        for (int attr = 0; attr < num_of_features; attr++)
-            update_array(cur->histogram_id, attr, point.label, point.get_value(attr));              
+        if (cur->histogram_id >= 0)
+            update_sparse(cur->histogram_id, point);
     }
+    for (int i = 0; i < num_unlabled_leaves; i++)
+        finish_sparse(i);
 }
 
 